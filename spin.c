@@ -47,11 +47,16 @@
 
 #include "spin.h"
 #include "spin_parse.h"
+#include "spin_patterns.h"
+#include "spin_proto.h"
+#include "spin_text.h"
+#include "spin_atom.h"
 #include "spin_chat.h"
 #include "spin_login.h"
 #include "spin_actions.h"
 #include "spin_userinfo.h"
 #include "spin_cmds.h"
+#include "spin_uring.h"
 /* #include "spin_privacy.h" */
 
 #include <unistd.h>
@@ -61,6 +66,11 @@
 #  include <winsock2.h>
 #else
 #  include <sys/socket.h>
+#  include <sys/uio.h>
+#endif
+#if defined(__linux__)
+#  define SPIN_USE_EPOLL 1
+#  include <sys/epoll.h>
 #endif
 
 static const char* spin_list_icon(PurpleAccount* a G_GNUC_UNUSED,
@@ -95,55 +105,7 @@ gchar* spin_encode_user(const gchar* user)
 {
   g_return_val_if_fail(user,NULL);
 
-  gsize bytes_in,bytes_out,len = strlen(user);
-  GError* error = NULL;
-  gchar* out = g_convert(user,len,"ISO-8859-15","UTF-8",&bytes_in,&bytes_out,
-			 &error);
-  if(error || bytes_in != len)
-    {
-      g_error_free(error);
-      if(out)
-	g_free(out);
-      return NULL;
-    }
-  return out;
-}
-
-gchar* spin_convert_in_text(const gchar* text)
-{
-  g_return_val_if_fail(text,NULL);
-  /* gchar* escaped; */
-
-  if(!g_utf8_validate(text,-1,NULL))
-    {
-      gsize bytes_in,bytes_out,len = strlen(text);
-      GError* error = NULL;
-      gchar* out = g_convert(text,len,"UTF-8","ISO-8859-15",&bytes_in,
-			     &bytes_out,&error);
-      if(error || bytes_in != len)
-	{
-	  g_error_free(error);
-	  if(out)
-	    g_free(out);
-	  return NULL;
-	}
-      /* escaped = g_markup_escape_text(out,-1); */
-      /* g_free(out); */
-      return out;
-    }
-  else
-    return g_strdup(text);
-  /*   escaped = g_markup_escape_text(text,-1); */
-  
-  /* return escaped; */
-}
-
-gchar* spin_convert_out_text(const gchar* text)
-{
-  gchar* no_html = purple_markup_strip_html(text);
-  gchar* no_entities =  purple_unescape_html(no_html);
-  g_free(no_html);
-  return no_entities;
+  return spin_utf8_to_latin9(user,-1);
 }
 
 gchar* spin_session_url(SpinData* spin,const gchar* targetfmt,...)
@@ -179,26 +141,40 @@ gchar* spin_url(SpinData* spin,const gchar* fmt,...)
   return uri;
 }
 
-static void spin_try_parse(SpinData* spin)
+static gboolean spin_deferred_cb(gpointer data)
 {
-  gchar* i = spin->inbuf->str,*j=i;
+  PurpleConnection* gc = (PurpleConnection*) data;
+  SpinData* spin = (SpinData*) gc->proto_data;
 
-  for(;i != spin->inbuf->str + spin->inbuf->len; ++i)
-    {
-      switch(*i)
-	{
-	case '\0':
-	  *i = ' ';
-	  break;
-	case '\n':
-	  *i = '\0';
-	  spin_parse_line(spin,j);
-	  j = i + 1;
-	  break;
-	}
-    }
+  spin_write_cork(spin);
+  gboolean more = spin_parse_run_deferred(spin);
+  spin_write_uncork(spin);
+  if(more)
+    return TRUE;
+  spin->deferred_handle = 0;
+  return FALSE;
+}
 
-  g_string_erase(spin->inbuf, 0, j - spin->inbuf->str);
+void spin_try_parse(SpinData* spin)
+{
+  gchar *line,*partial;
+  gsize len;
+
+  /* replies to everything read in this pass leave together */
+  spin_write_cork(spin);
+  while((line = spin_framer_next_line(spin->inbuf)))
+    spin_parse_dispatch(spin,line);
+
+  partial = spin_framer_partial(spin->inbuf,&len);
+  if(len)
+    spin_framer_consume(spin->inbuf,spin_parse_partial(spin,partial,len));
+
+  /* bulk lines get one slice now, the rest runs when the loop is idle */
+  if(spin_parse_run_deferred(spin) && !spin->deferred_handle)
+    spin->deferred_handle = purple_timeout_add(0,spin_deferred_cb,spin->gc);
+  spin_write_uncork(spin);
+
+  spin_framer_settle(spin->inbuf,2 * spin->read_chunk);
 }
 
 static gboolean check_socket_error(PurpleConnection* gc,ssize_t ret)
@@ -236,7 +212,183 @@ static gboolean check_socket_error(PurpleConnection* gc,ssize_t ret)
 #endif
 }
 
-static void write_cb(gpointer data,gint fd,
+/* remembers when the command just queued was enqueued */
+static void spin_write_queued(SpinData* spin,gsize len)
+{
+  spin->out_queued += len;
+  if(!spin->profile || spin->out_timed_len == SPIN_OUT_TIMED)
+    return;
+
+  SpinOutTimed* t = &spin->out_timed[(spin->out_timed_head
+				      + spin->out_timed_len++)
+				     % SPIN_OUT_TIMED];
+  t->end = spin->out_queued;
+  t->time = g_get_monotonic_time();
+}
+
+/* the output queue holds one or two runs, the second one from the start
+   of the buffer while the first reaches its end */
+#define SPIN_OUTBUF_MIN 1024
+
+static gsize spin_outbuf_first(const SpinOutbuf* buf)
+{
+  return MIN(buf->used,buf->size - buf->start);
+}
+
+/* returns room for len bytes at the write end of the queue. When the room
+   behind the queued bytes is too small they are moved to the front or
+   into a larger buffer. */
+static gchar* spin_outbuf_reserve(SpinOutbuf* buf,gsize len)
+{
+  gsize end = buf->start + buf->used;
+  gsize first,size;
+  gchar* data;
+
+  if(!buf->used)
+    buf->start = end = 0;
+
+  if(end < buf->size && buf->size - end >= len)
+    return buf->data + end;
+  if(end >= buf->size && buf->start - (end - buf->size) >= len)
+    return buf->data + end - buf->size;
+  if(end <= buf->size && buf->size - buf->used >= len)
+    {
+      memmove(buf->data,buf->data + buf->start,buf->used);
+      buf->start = 0;
+      return buf->data + buf->used;
+    }
+
+  size = MAX(MAX(2 * buf->size,buf->used + len),SPIN_OUTBUF_MIN);
+  data = g_malloc(size);
+  first = spin_outbuf_first(buf);
+  memcpy(data,buf->data + buf->start,first);
+  memcpy(data + first,buf->data,buf->used - first);
+  g_free(buf->data);
+  buf->data = data;
+  buf->size = size;
+  buf->start = 0;
+  return buf->data + buf->used;
+}
+
+/* queues len bytes written to the room of spin_outbuf_reserve */
+static void spin_outbuf_commit(SpinOutbuf* buf,gsize len)
+{
+  buf->used += len;
+}
+
+static void spin_write_drop(SpinData* spin,gsize len)
+{
+  SpinOutbuf* buf = &spin->outbuf;
+
+  buf->start += len;
+  if(buf->start >= buf->size)
+    buf->start -= buf->size;
+  buf->used -= len;
+}
+
+gsize spin_write_take(SpinData* spin,gchar* dst)
+{
+  SpinOutbuf* buf = &spin->outbuf;
+  gsize first = spin_outbuf_first(buf),len = buf->used;
+
+  memcpy(dst,buf->data + buf->start,first);
+  memcpy(dst + first,buf->data,len - first);
+  spin_write_drop(spin,len);
+  return len;
+}
+
+gsize spin_write_pending(SpinData* spin)
+{
+  return spin->outbuf.used;
+}
+
+void spin_write_done(SpinData* spin,gsize len)
+{
+  gint64 now = 0;
+
+  spin->out_sent += len;
+  /* commands sent completely get their latency recorded */
+  while(spin->out_timed_len
+	&& spin->out_timed[spin->out_timed_head].end <= spin->out_sent)
+    {
+      gint64 usecs;
+      guint b = 0;
+
+      if(!now)
+	now = g_get_monotonic_time();
+      usecs = now - spin->out_timed[spin->out_timed_head].time;
+      while(b + 1 < SPIN_LATENCY_BUCKETS && usecs >= (16 << 2 * b))
+	++b;
+      spin->stats.latency[b]++;
+      spin->out_timed_head = (spin->out_timed_head + 1) % SPIN_OUT_TIMED;
+      spin->out_timed_len--;
+    }
+}
+
+/* hands as much of the queue as the socket takes to the kernel with one
+   call, both runs of the ring at once */
+static ssize_t spin_send_queued(SpinData* spin)
+{
+  SpinOutbuf* buf = &spin->outbuf;
+  gsize first = spin_outbuf_first(buf);
+  ssize_t written;
+
+#ifdef WIN32
+  written = send(spin->fd,buf->data + buf->start,first,0);
+#else
+  struct iovec iov[2];
+  struct msghdr msg;
+
+  iov[0].iov_base = buf->data + buf->start;
+  iov[0].iov_len = first;
+  iov[1].iov_base = buf->data;
+  iov[1].iov_len = buf->used - first;
+  memset(&msg,0,sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iov[1].iov_len ? 2 : 1;
+  written = sendmsg(spin->fd,&msg,0);
+#endif
+  spin->stats.send_calls++;
+  if(written > 0)
+    {
+      spin_write_drop(spin,written);
+      spin_write_done(spin,written);
+    }
+  return written;
+}
+
+/* writes until the queue is empty or the socket would block, returns
+   whether the queue was drained */
+static gboolean spin_send_all(SpinData* spin)
+{
+  while(spin->outbuf.used)
+    {
+      gsize queued = spin->outbuf.used;
+      ssize_t written = spin_send_queued(spin);
+      if(written <= 0)
+	{
+	  check_socket_error(spin->gc,written);
+	  return FALSE;
+	}
+      if((gsize) written < queued)
+	spin->stats.partial_writes++;
+    }
+  return TRUE;
+}
+
+/* a backlog that needed write wakeups has been sent completely */
+static void spin_write_drained(SpinData* spin)
+{
+  SpinIOStats* stats = &spin->stats;
+
+  stats->flushes++;
+  stats->flush_wakeups += spin->flush_wakeups;
+  stats->flush_wakeups_peak = MAX(stats->flush_wakeups_peak,
+				  spin->flush_wakeups);
+  spin->flush_wakeups = 0;
+}
+
+static void write_cb(gpointer data,gint fd G_GNUC_UNUSED,
 		     PurpleInputCondition cond G_GNUC_UNUSED)
 {
   PurpleConnection* gc = (PurpleConnection*) data;
@@ -245,53 +397,241 @@ static void write_cb(gpointer data,gint fd,
   if(!spin)
     return;
 
-  guint to_write = purple_circ_buffer_get_max_read(spin->outbuf);
-
-  if(to_write == 0)
+  if(!spin->outbuf.used)
     {
       purple_input_remove(spin->write_handle);
       spin->write_handle = 0;
       return;
     }
 
-  // ssize_t written = write(fd,spin->outbuf->outptr,to_write);
-  ssize_t written = send(fd,spin->outbuf->outptr,to_write,0);
-  if(check_socket_error(gc,written))
-     return;
+  spin->stats.write_wakeups++;
+  spin->flush_wakeups++;
+  if(!spin_send_all(spin))
+    return;
 
-  purple_circ_buffer_mark_read(spin->outbuf,written);
+  /* the watch is only needed again for the next backlog */
+  purple_input_remove(spin->write_handle);
+  spin->write_handle = 0;
+  spin_write_drained(spin);
 }
 
+#if SPIN_USE_EPOLL
+/* write interest is only registered while the queue is blocked */
+static void spin_epoll_want_write(SpinData* spin,gboolean want)
+{
+  struct epoll_event ev;
+
+  memset(&ev,0,sizeof(ev));
+  ev.events = EPOLLIN | EPOLLET | (want ? EPOLLOUT : 0);
+  if(epoll_ctl(spin->epoll_fd,EPOLL_CTL_MOD,spin->fd,&ev) < 0)
+    purple_debug_warning("spin","epoll_ctl: %s\n",g_strerror(errno));
+}
+
+/* with the edge triggered registration the socket is written until it
+   would block, after that the next EPOLLOUT edge continues */
+static void spin_epoll_flush(SpinData* spin)
+{
+  gboolean blocked = !spin_send_all(spin);
+
+  if(blocked != spin->write_blocked)
+    spin_epoll_want_write(spin,blocked);
+  spin->write_blocked = blocked;
+}
+#endif
+
+/* hands queued output to whichever backend is writing the socket */
+static void spin_write_flush(SpinData* spin)
+{
+#if SPIN_USE_IO_URING
+  if(spin->uring)
+    {
+      spin_uring_flush(spin);
+      return;
+    }
+#endif
+
+#if SPIN_USE_EPOLL
+  /* a blocked socket is continued by the next EPOLLOUT edge */
+  if(spin->epoll_fd >= 0)
+    {
+      if(!spin->write_blocked)
+	spin_epoll_flush(spin);
+      return;
+    }
+#endif
+
+  /* with a watch the socket is busy and the command waits its turn. An
+     idle one is written right away, the watch only takes the rest. */
+  if(spin->write_handle)
+    return;
+
+  ssize_t written = spin_send_queued(spin);
+  if(written >= 0)
+    spin->stats.immediate_sends++;
+  else if(check_socket_error(spin->gc,written))
+    return;
+  if(written >= 0 && spin->outbuf.used)
+    spin->stats.partial_writes++;
+
+  if(spin->outbuf.used)
+    spin->write_handle = purple_input_add(spin->fd,PURPLE_INPUT_WRITE,write_cb,spin->gc);
+}
+
+void spin_write_cork(SpinData* spin)
+{
+  spin->cork++;
+}
+
+void spin_write_uncork(SpinData* spin)
+{
+  g_return_if_fail(spin->cork > 0);
+
+  if(--spin->cork || !spin->outbuf.used)
+    return;
+  spin->stats.batches++;
+  spin_write_flush(spin);
+}
+
+void spin_write_fields(SpinData* spin,gchar cmd,const SpinOutField* f,
+		       guint n)
+{
+  gchar* out;
+  gsize len = 2 + (n ? n - 1 : 0);
+  gboolean me;
+  gchar* p,*q,*ty;
+  gsize j;
+  guint i;
+
+  /* an upper bound, sanitized fields never grow */
+  for(i = 0; i < n; ++i)
+    len += f[i].len + (f[i].enc == SPIN_ENC_SAY ? 2 : 0);
+
+  /* encoded straight into the queue */
+  p = out = spin_outbuf_reserve(&spin->outbuf,len);
+  *p++ = cmd;
+  for(i = 0; i < n; ++i)
+    {
+      if(i)
+	*p++ = '#';
+      switch(f[i].enc)
+	{
+	case SPIN_ENC_RAW:
+	  memcpy(p,f[i].str,f[i].len);
+	  p += f[i].len;
+	  break;
+	case SPIN_ENC_NAME:
+	case SPIN_ENC_TEXT:
+	  for(j = 0; j < f[i].len; ++j)
+	    p[j] = f[i].str[j] == '\n' ? ' ' : f[i].str[j];
+	  p += f[i].len;
+	  break;
+	case SPIN_ENC_HTML:
+	  p += spin_text_out(f[i].str,p,NULL);
+	  break;
+	case SPIN_ENC_SAY:
+	  /* the type is only known once the text is written */
+	  ty = p;
+	  p += 2 + spin_text_out(f[i].str,p + 2,&me);
+	  ty[0] = me ? 'c' : 'a';
+	  ty[1] = '#';
+	  break;
+	}
+    }
+  /* no field may end the command early, whatever its encoding */
+  for(q = out; (q = memchr(q,'\n',p - q)); ++q)
+    {
+      g_warn_if_reached();
+      *q = ' ';
+    }
+  *p = '\n';
+  spin_outbuf_commit(&spin->outbuf,p + 1 - out);
+  spin_write_queued(spin,p + 1 - out);
+  spin->stats.commands++;
+  if(spin->cork)
+    spin->stats.corked++;
+
+  /* a corked command leaves together with the others at the uncork */
+  if(!spin->cork)
+    spin_write_flush(spin);
+}
+
+/* generic form for commands that are not in the schema, see spin_proto.h */
 void spin_write_command(SpinData* spin,gchar cmd,...)
 {
-  GString* out = g_string_new("");
+  SpinOutField f[SPIN_MAX_OUT_FIELDS];
   const gchar* arg;
-  g_string_append_c(out,cmd);
-
+  guint n = 0;
   va_list ap;
+
   va_start(ap,cmd);
-  int first = 1;
-  while((arg = va_arg(ap,const gchar*)))
+  while((arg = va_arg(ap,const gchar*)) && n < SPIN_MAX_OUT_FIELDS)
     {
-      if(!first)
-	g_string_append_c(out,'#');
-      else
-	first = 0;
-      g_string_append(out,arg);
+      f[n].str = arg;
+      f[n].len = strlen(arg);
+      f[n].enc = SPIN_ENC_TEXT;
+      ++n;
     }
   va_end(ap);
+  g_return_if_fail(arg == NULL);
 
-  gsize i;
-  for(i = 0; i < out->len; ++i)
-    if(out->str[i] == '\n')
-      out->str[i] = ' ';
+  spin_write_fields(spin,cmd,f,n);
+}
 
-  g_string_append_c(out,'\n');
+void spin_io_stats_tick(SpinData* spin)
+{
+  SpinIOStats* stats = &spin->stats;
+  gint64 now = g_get_monotonic_time();
 
-  purple_circ_buffer_append(spin->outbuf,out->str,out->len);
+  if(!stats->since)
+    stats->since = now;
+  if(now - stats->since < G_USEC_PER_SEC)
+    return;
 
-  if(!spin->write_handle)
-    spin->write_handle = purple_input_add(spin->fd,PURPLE_INPUT_WRITE,write_cb,spin->gc);
+  if(stats->read_wakeups)
+    purple_debug_misc("spin","io: %.1f read wakeups/s, %u recv calls, "
+		      "%" G_GUINT64_FORMAT " bytes/wakeup, chunk %" G_GSIZE_FORMAT
+		      "\n",
+		      stats->read_wakeups * (gdouble) G_USEC_PER_SEC
+		      / (now - stats->since),
+		      stats->read_calls,
+		      stats->read_bytes / stats->read_wakeups,
+		      spin->read_chunk);
+  if(stats->commands)
+    purple_debug_misc("spin","io: %u commands, %u send calls, "
+		      "%u write wakeups, %u io_uring submits, "
+		      "%u corked in %u batches\n",
+		      stats->commands,stats->send_calls,stats->write_wakeups,
+		      stats->submits,stats->corked,stats->batches);
+  if(stats->flushes || stats->partial_writes)
+    purple_debug_misc("spin","io: %u partial writes, %u backlogs drained "
+		      "with %.1f write wakeups each (peak %u)\n",
+		      stats->partial_writes,stats->flushes,
+		      stats->flushes
+		      ? stats->flush_wakeups / (gdouble) stats->flushes : 0.0,
+		      stats->flush_wakeups_peak);
+  if(stats->commands && spin->profile)
+    purple_debug_misc("spin","io: %u immediate sends, enqueue to kernel "
+		      "<16us %u, <64us %u, <256us %u, <1ms %u, <4ms %u, "
+		      "<16ms %u, <65ms %u, more %u\n",
+		      stats->immediate_sends,
+		      stats->latency[0],stats->latency[1],stats->latency[2],
+		      stats->latency[3],stats->latency[4],stats->latency[5],
+		      stats->latency[6],stats->latency[7]);
+  if(stats->lines[SPIN_PRIO_CONTROL] || stats->lines[SPIN_PRIO_INTERACTIVE]
+     || stats->lines[SPIN_PRIO_BULK])
+    purple_debug_misc("spin","parse: control %u lines/%.1f ms, "
+		      "interactive %u lines/%.1f ms, bulk %u lines/%.1f ms, "
+		      "%u deferred (peak %u)\n",
+		      stats->lines[SPIN_PRIO_CONTROL],
+		      stats->usecs[SPIN_PRIO_CONTROL] / 1000.0,
+		      stats->lines[SPIN_PRIO_INTERACTIVE],
+		      stats->usecs[SPIN_PRIO_INTERACTIVE] / 1000.0,
+		      stats->lines[SPIN_PRIO_BULK],
+		      stats->usecs[SPIN_PRIO_BULK] / 1000.0,
+		      spin->deferred.length,stats->deferred_peak);
+
+  memset(stats,0,sizeof(SpinIOStats));
+  stats->since = now;
 }
 
 static void read_cb(gpointer data,gint fd,
@@ -300,23 +640,130 @@ static void read_cb(gpointer data,gint fd,
   PurpleConnection* gc = (PurpleConnection*) data;
   SpinData* spin = (SpinData*) gc->proto_data;
 
-  gchar buf[1024];
-  //ssize_t nread = read(fd, buf, 1024);
-  ssize_t nread = recv(fd, buf, 1024, 0);
-  if(check_socket_error(gc,nread))
+  if(!spin)
     return;
 
-  if(spin)
+  /* drain the socket completely, so a burst costs one wakeup and one
+     parse pass instead of one per 1k */
+  gsize total = 0;
+  ssize_t nread;
+  for(;;)
+    {
+      gchar* buf = spin_framer_reserve(spin->inbuf,spin->read_chunk);
+      nread = recv(fd,buf,spin->read_chunk,0);
+      spin->stats.read_calls++;
+
+      if(nread <= 0)
+	break;
+
+      spin_framer_commit(spin->inbuf,nread);
+      total += nread;
+      if((gsize) nread == spin->read_chunk
+	 && spin->read_chunk < SPIN_READ_CHUNK_MAX)
+	spin->read_chunk *= 2;
+
+      /* let the parser work off the buffer before reading on, streamed
+	 lines are consumed while they arrive */
+      if(spin_framer_pending(spin->inbuf) >= spin->max_inbuf)
+	{
+	  spin_try_parse(spin);
+	  if(spin_framer_pending(spin->inbuf) >= spin->max_inbuf)
+	    {
+	      purple_connection_error_reason
+		(gc,PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+		 _("received line is too long"));
+	      return;
+	    }
+	}
+    }
+
+  if(total < spin->read_chunk / 4 && spin->read_chunk > SPIN_READ_CHUNK_MIN)
+    spin->read_chunk /= 2;
+
+  spin->stats.read_wakeups++;
+  spin->stats.read_bytes += total;
+
+  /* parse what we got before a possible error tears down the connection,
+     the server usually tells us why it closes it */
+  if(total)
     {
-      g_string_append_len(spin->inbuf,buf,nread);
+#ifdef WIN32
+      int err = WSAGetLastError();
+      spin_try_parse(spin);
+      WSASetLastError(err);
+#else
+      int err = errno;
       spin_try_parse(spin);
+      errno = err;
+#endif
     }
+
+  if(check_socket_error(gc,nread))
+    return;
+
+  spin_io_stats_tick(spin);
+}
+
+#if SPIN_USE_EPOLL
+static void epoll_cb(gpointer data,gint epfd,
+		     PurpleInputCondition cond G_GNUC_UNUSED)
+{
+  PurpleConnection* gc = (PurpleConnection*) data;
+  SpinData* spin = (SpinData*) gc->proto_data;
+  struct epoll_event ev;
+
+  if(!spin || epoll_wait(epfd,&ev,1,0) <= 0)
+    return;
+
+  if((ev.events & (EPOLLOUT|EPOLLERR|EPOLLHUP)) && spin->write_blocked)
+    {
+      spin->stats.write_wakeups++;
+      spin->flush_wakeups++;
+      spin_epoll_flush(spin);
+      if(!spin->write_blocked)
+	spin_write_drained(spin);
+    }
+  if(ev.events & (EPOLLIN|EPOLLERR|EPOLLHUP))
+    read_cb(data,spin->fd,PURPLE_INPUT_READ);
+}
+
+/* registers the socket once, the epoll descriptor is watched by the ui's
+   event loop */
+static gboolean spin_epoll_start(SpinData* spin)
+{
+  struct epoll_event ev;
+
+  if((spin->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    return FALSE;
+
+  memset(&ev,0,sizeof(ev));
+  ev.events = EPOLLIN | EPOLLET;
+  if(epoll_ctl(spin->epoll_fd,EPOLL_CTL_ADD,spin->fd,&ev) < 0)
+    {
+      purple_debug_warning("spin","epoll_ctl: %s\n",g_strerror(errno));
+      close(spin->epoll_fd);
+      spin->epoll_fd = -1;
+      return FALSE;
+    }
+
+  spin->read_handle = purple_input_add(spin->epoll_fd,PURPLE_INPUT_READ,
+				       epoll_cb,spin->gc);
+  return TRUE;
 }
+#endif
 
 void spin_start_read(SpinData* spin)
 {
-  if(spin->read_handle)
+  if(spin->read_handle || spin->uring)
+    return;
+#if SPIN_USE_IO_URING
+  if(spin_uring_start(spin))
+    return;
+#endif
+#if SPIN_USE_EPOLL
+  if(spin_epoll_start(spin))
     return;
+#endif
   spin->read_handle = purple_input_add(spin->fd, PURPLE_INPUT_READ, read_cb,spin->gc);
 }
 
@@ -328,20 +775,11 @@ static int spin_send_im(PurpleConnection* gc,const char* who,
   if(!spin->fd)
     return /*-ENOTCONN;*/ -1;
 
-  gchar* who_2;
-  if(!(who_2 = spin_encode_user(who)))
+  SpinAtom* atom;
+  if(!(atom = spin_atom_utf8(spin,who)))
     return -1;
-  
-  gchar* msg_2 = spin_convert_out_text(msg);
-  
-  const gchar* ty = "a";
-  if(purple_message_meify(msg_2,-1))
-    ty = "c";
-  
-  spin_write_command(spin,'h',who_2,"0",ty,msg_2,NULL);
-  
-  g_free(msg_2);
-  g_free(who_2);
+
+  spin_send_im_say(spin,atom->raw,"0",msg);
   return 1;
 }
 
@@ -355,19 +793,18 @@ void spin_set_status(PurpleAccount* account,PurpleStatus* status)
   PurpleStatusPrimitive prim = purple_status_type_get_primitive(type);
   purple_debug_info("spin","SET STATUS: %i\n",prim);
   const gchar* msg,*room_away_state = NULL;
+  spin_write_cork(spin);
   switch(prim)
     {
     case PURPLE_STATUS_AVAILABLE:
-      spin_write_command(spin,'W',"2","a","",NULL);
+      spin_send_away(spin,"2","a","");
       room_away_state = "0#away#0";
       break;
     case PURPLE_STATUS_AWAY:
       msg = purple_status_get_attr_string(status,"message");
       if(!msg)
 	msg = _("user is away");
-      gchar* msg_2 = spin_convert_out_text(msg);
-      spin_write_command(spin,'W',"1","a",msg_2,NULL);
-      g_free(msg_2);
+      spin_send_away(spin,"1","a",msg);
       room_away_state = "0#away#1";
       break;
     default:
@@ -383,7 +820,7 @@ void spin_set_status(PurpleAccount* account,PurpleStatus* status)
       const gchar* name = purple_conversation_get_name(conv);
       spin_chat_set_room_status(spin,name,status);
     }
-  
+  spin_write_uncork(spin);
 }
 
 static gboolean spin_ping_timeout(gpointer data)
@@ -397,7 +834,7 @@ static gboolean spin_ping_timeout(gpointer data)
 static void spin_keepalive(PurpleConnection* gc)
 {
   SpinData* spin = (SpinData*) gc->proto_data;
-  spin_write_command(spin,'J',"p",NULL);
+  spin_send_ping(spin,"p");
   if(!spin->ping_timeout_handle)
     spin->ping_timeout_handle = purple_timeout_add_seconds(60,spin_ping_timeout,gc);
 }
@@ -422,16 +859,66 @@ static gchar* spin_status_text(PurpleBuddy* buddy)
   return g_strdup(msg);
 }
 
+/* a result stays valid until SPIN_NORMALIZE_CACHE other names have been
+   normalized */
+#define SPIN_NORMALIZE_CACHE 256
+
+static struct
+{
+  GHashTable* index; /* name -> slot */
+  struct
+  {
+    gchar* name;
+    gchar* normalized;
+  } slots[SPIN_NORMALIZE_CACHE];
+  guint next;
+} spin_normalized;
+
 static const gchar* spin_normalize(const PurpleAccount* account G_GNUC_UNUSED,
 				   const gchar* name)
 {
-  static gchar buf[2048];
-  gchar* down = g_ascii_strdown(name,-1);
-  gchar* normalized = g_utf8_normalize(down,-1,G_NORMALIZE_DEFAULT_COMPOSE);
-  g_strlcpy(buf,normalized,2048);
-  g_free(normalized);
-  g_free(down);
-  return buf;
+  gpointer slot;
+  gsize len,i;
+  gchar* down;
+
+  g_return_val_if_fail(name,NULL);
+
+  if(!spin_normalized.index)
+    spin_normalized.index = g_hash_table_new(g_str_hash,g_str_equal);
+  else if((slot = g_hash_table_lookup(spin_normalized.index,name)))
+    return spin_normalized.slots[GPOINTER_TO_UINT(slot) - 1].normalized;
+
+  len = strlen(name);
+  down = g_malloc(len + 1);
+  for(i = 0; i < len; ++i)
+    down[i] = g_ascii_tolower(name[i]);
+  down[len] = '\0';
+
+  /* NFC leaves ASCII alone */
+  if(spin_text_ascii_prefix(name,len) < len)
+    {
+      gchar* composed = g_utf8_normalize(down,len,
+					 G_NORMALIZE_DEFAULT_COMPOSE);
+      g_free(down);
+      /* invalid UTF-8, keep it from the cache */
+      if(!composed)
+	return "";
+      down = composed;
+    }
+
+  i = spin_normalized.next;
+  spin_normalized.next = (i + 1) % SPIN_NORMALIZE_CACHE;
+  if(spin_normalized.slots[i].name)
+    {
+      g_hash_table_remove(spin_normalized.index,spin_normalized.slots[i].name);
+      g_free(spin_normalized.slots[i].name);
+      g_free(spin_normalized.slots[i].normalized);
+    }
+  spin_normalized.slots[i].name = g_strndup(name,len);
+  spin_normalized.slots[i].normalized = down;
+  g_hash_table_insert(spin_normalized.index,spin_normalized.slots[i].name,
+		      GUINT_TO_POINTER(i + 1));
+  return down;
 }
 
 
@@ -553,6 +1040,8 @@ static void init_plugin(PurplePlugin* plugin G_GNUC_UNUSED)
   bind_textdomain_codeset(GETTEXT_PACKAGE,"UTF-8");
 #endif
 
+  spin_patterns_init();
+
   option = purple_account_option_string_new(_("Server"),"server","www.spin.de");
   ol = g_list_append(ol,option);
   option = purple_account_option_int_new(_("Port"),"port",3003);
@@ -583,10 +1072,24 @@ static void init_plugin(PurplePlugin* plugin G_GNUC_UNUSED)
 					    "nick-regex","");
   ol = g_list_append(ol, option);
 
+  option = purple_account_option_string_new(_("Highlight words "
+					      "(comma separated)"),
+					    "highlight-words","");
+  ol = g_list_append(ol, option);
+
   option = purple_account_option_bool_new(_("Use secure login"),
 					  "secure-login",TRUE);
   ol = g_list_append(ol, option);
 
+  option = purple_account_option_int_new(_("Maximum line buffer (KiB)"),
+					 "max-line-buffer",
+					 SPIN_MAX_LINE_BUFFER);
+  ol = g_list_append(ol, option);
+
+  option = purple_account_option_bool_new(_("Log timing statistics"),
+					  "profile",FALSE);
+  ol = g_list_append(ol, option);
+
   prpl_info.protocol_options = ol;
 
   /* GList* splits = NULL; */
@@ -29,6 +29,8 @@
 #include "account.h"
 #include "circbuffer.h"
 
+#include "spin_framer.h"
+
 typedef enum
   {
     SPIN_STATE_GOT_WEB_LOGIN = (1<<0),
@@ -40,13 +42,144 @@ typedef enum
     SPIN_STATE_ALL_CONNECTION_STATES = ((1<<5)-1)
   } SpinConnectionState;
 
+/* bounds for the adaptive receive size of the chat socket */
+#define SPIN_READ_CHUNK_MIN 1024
+#define SPIN_READ_CHUNK_MAX (64*1024)
+/* default upper bound for a not yet complete line, in KiB */
+#define SPIN_MAX_LINE_BUFFER 4096
+
+/* inbound lines are dispatched by class: control and interactive lines
+   at once, bulk lines (member, room and ban lists) afterwards */
+typedef enum
+  {
+    SPIN_PRIO_CONTROL,
+    SPIN_PRIO_INTERACTIVE,
+    SPIN_PRIO_BULK,
+    SPIN_PRIO_COUNT
+  } SpinPriority;
+
+/* sub-commands of '0'-type messages */
+typedef enum
+  {
+    SPIN_NULL_AWAY,
+    SPIN_NULL_PING,
+    SPIN_NULL_NOSPAM,
+    SPIN_NULL_INVITE,
+    SPIN_NULL_WARN,
+    SPIN_NULL_COUNT
+  } SpinNullCommand;
+/* size of the hash table of the sub-commands, see spin_parse.c */
+#define SPIN_NULL_SLOTS 8
+
+/* what a received line means, see spin_event.h */
+typedef enum
+  {
+    SPIN_EVENT_CONNECTED,
+    SPIN_EVENT_DISCONNECTED,
+    SPIN_EVENT_PONG,
+    SPIN_EVENT_PRIVATE_MSG,
+    SPIN_EVENT_AWAY_MSG,
+    SPIN_EVENT_PING_REQUEST,
+    SPIN_EVENT_NOSPAM,
+    SPIN_EVENT_GAME_INVITE,
+    SPIN_EVENT_STATUS,
+    SPIN_EVENT_NOTIFY,
+    SPIN_EVENT_JOIN,
+    SPIN_EVENT_LEAVE,
+    SPIN_EVENT_CHAT_MSG,
+    SPIN_EVENT_WARN,
+    SPIN_EVENT_CHAT_AWAY,
+    SPIN_EVENT_MSG_ERROR,
+    SPIN_EVENT_CHAT_ERROR,
+    SPIN_EVENT_ROOMINFO,
+    SPIN_EVENT_USERMODE,
+    SPIN_EVENT_ROOMMODE,
+    SPIN_EVENT_ROOM_CHECK,
+    SPIN_EVENT_LIST_BEGIN,
+    SPIN_EVENT_LIST_ENTRY,
+    SPIN_EVENT_LIST_END,
+    SPIN_EVENT_COUNT
+  } SpinEventType;
+
+typedef struct
+{
+  guint hits;
+  gint64 usecs;
+} SpinVerbStats;
+
+/* time slice for bulk lines per read or idle callback, in usec */
+#define SPIN_BULK_BUDGET 20000
+/* number of name atoms kept before they are dropped, see spin_atom.h */
+#define SPIN_ATOMS_MAX 4096
+/* upper bound for the per-session buffer inbound texts are decoded
+   into, longer texts are allocated */
+#define SPIN_TEXT_BUF_MAX 65536
+/* buckets of the enqueue to kernel latency histogram, each four times as
+   wide as the one before starting at 16 usec, the last one is open */
+#define SPIN_LATENCY_BUCKETS 8
+/* queued commands whose enqueue time is kept, later ones are not timed */
+#define SPIN_OUT_TIMED 64
+
+typedef struct
+{
+  gint64 since;
+  guint read_wakeups;
+  guint read_calls;
+  guint64 read_bytes;
+  guint commands;
+  guint send_calls;
+  guint write_wakeups;
+  guint immediate_sends; /* sent without waiting for a write watch */
+  guint corked,batches; /* commands held back, flushes at uncork */
+  guint partial_writes;
+  /* backlogs that needed write wakeups, and those wakeups */
+  guint flushes,flush_wakeups,flush_wakeups_peak;
+  guint latency[SPIN_LATENCY_BUCKETS];
+  guint submits;
+  guint lines[SPIN_PRIO_COUNT];
+  gint64 usecs[SPIN_PRIO_COUNT];
+  guint deferred_peak;
+} SpinIOStats;
+
+/* when a queued command was enqueued, by its end in the output stream */
+typedef struct
+{
+  guint64 end;
+  gint64 time;
+} SpinOutTimed;
+
+/* encoded commands not yet handed to the kernel, see spin.c */
+typedef struct
+{
+  gchar* data;
+  gsize size,start,used;
+} SpinOutbuf;
+
+typedef struct _SpinStream SpinStream;
+typedef struct _SpinUring SpinUring;
+typedef struct _SpinAtom SpinAtom;
+typedef struct _SpinHighlight SpinHighlight;
+
 struct _SpinData
 {
   PurpleConnection* gc;
-  gint fd;
-
-  GString* inbuf;
-  PurpleCircBuffer* outbuf;
+  gint fd,epoll_fd;
+  gboolean write_blocked;
+  SpinUring* uring;
+
+  SpinFramer* inbuf;
+  gsize read_chunk,max_inbuf;
+  SpinStream* stream;
+  GQueue deferred; /* copies of bulk lines not yet handled */
+  GHashTable* deferred_rooms; /* raw room -> number of deferred lines */
+  guint deferred_handle;
+  gint64 stream_usecs; /* streamed bulk work since the last deferred pass */
+  SpinOutbuf outbuf;
+  guint cork; /* nesting of spin_write_cork */
+  guint flush_wakeups; /* write wakeups of the current backlog */
+  guint64 out_queued,out_sent; /* bytes ever queued, handed to the kernel */
+  SpinOutTimed out_timed[SPIN_OUT_TIMED];
+  guint out_timed_head,out_timed_len;
 
   gchar* session;
   guint write_handle,read_handle;
@@ -55,22 +188,48 @@ struct _SpinData
   PurpleRoomlist* roomlist;
 
   gchar* username;
-  gchar* normalized_username;
-  GRegex* nick_regex;
+  SpinAtom* self; /* the atom of username */
+  GRegex* nick_regex; /* only for a configured nick-regex */
+  SpinHighlight* highlight; /* nick and highlight-words */
 
   GHashTable* pending_joins;
   GHashTable* updated_status_list;
+  GHashTable* member_updates; /* chat id -> queued joins/leaves */
+  /* interned names, see spin_atom.h */
+  GHashTable* atoms_raw,*atoms_utf8,*atoms_normalized;
+
+  GString* render; /* markup for the conversation, see spin_write_chat */
+  /* inbound texts of the current line, see spin_field_text */
+  gchar* text_buf;
+  gsize text_size,text_used,text_want;
+
+  SpinIOStats stats;
+  gboolean profile; /* time lines, events and sends, see "profile" option */
+  /* cumulative per opcode (decoding), per event (applying) and per '0'
+     sub-command (both) */
+  SpinVerbStats opcode_stats[256];
+  SpinVerbStats event_stats[SPIN_EVENT_COUNT];
+  SpinVerbStats null_stats[SPIN_NULL_SLOTS];
 };
 typedef struct _SpinData SpinData;
 
 void spin_set_status(PurpleAccount* account,PurpleStatus* status);
 void spin_write_command(SpinData* spin,gchar cmd,...) G_GNUC_NULL_TERMINATED;
+/* between cork and uncork commands are only queued, the outermost uncork
+   flushes them with one vectored send */
+void spin_write_cork(SpinData* spin);
+void spin_write_uncork(SpinData* spin);
+/* bytes in the output queue */
+gsize spin_write_pending(SpinData* spin);
+/* moves the whole output queue to dst, returns its length */
+gsize spin_write_take(SpinData* spin,gchar* dst);
+/* records that len queued bytes have been handed to the kernel */
+void spin_write_done(SpinData* spin,gsize len);
 void spin_start_read(SpinData* spin);
+void spin_try_parse(SpinData* spin);
+void spin_io_stats_tick(SpinData* spin);
 gchar* spin_encode_user(const gchar* user);
 
-gchar* spin_convert_in_text(const gchar* text);
-gchar* spin_convert_out_text(const gchar* text);
-
 gchar* spin_session_url(SpinData* spin,const gchar* targetfmt,...);
 gchar* spin_url(SpinData* spin,const gchar* fmt,...);
 
@@ -0,0 +1,132 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+#include "spin_atom.h"
+#include "spin_text.h"
+
+#include "connection.h"
+
+#include <string.h>
+
+static void spin_atom_free(gpointer data)
+{
+  SpinAtom* atom = (SpinAtom*) data;
+  g_free(atom->raw);
+  g_free(atom->utf8);
+  g_free(atom);
+}
+
+void spin_atoms_init(SpinData* spin)
+{
+  /* a name can have several UTF-8 spellings, so that index owns its keys */
+  spin->atoms_raw = g_hash_table_new_full(g_str_hash,g_str_equal,NULL,
+					  spin_atom_free);
+  spin->atoms_utf8 = g_hash_table_new_full(g_str_hash,g_str_equal,g_free,
+					   NULL);
+  spin->atoms_normalized = g_hash_table_new_full(g_str_hash,g_str_equal,
+						 g_free,NULL);
+}
+
+void spin_atoms_free(SpinData* spin)
+{
+  if(spin->atoms_utf8)
+    g_hash_table_destroy(spin->atoms_utf8);
+  if(spin->atoms_raw)
+    g_hash_table_destroy(spin->atoms_raw);
+  if(spin->atoms_normalized)
+    g_hash_table_destroy(spin->atoms_normalized);
+  spin->atoms_utf8 = spin->atoms_raw = spin->atoms_normalized = NULL;
+  spin->self = NULL;
+}
+
+void spin_atoms_trim(SpinData* spin)
+{
+  SpinAtom* self = spin->self;
+
+  /* every atom has a UTF-8 key, some have more */
+  if(g_hash_table_size(spin->atoms_utf8) <= SPIN_ATOMS_MAX)
+    return;
+
+  if(self)
+    {
+      g_hash_table_steal(spin->atoms_raw,self->raw);
+      g_hash_table_steal(spin->atoms_normalized,self->normalized);
+    }
+  g_hash_table_remove_all(spin->atoms_utf8);
+  g_hash_table_remove_all(spin->atoms_raw);
+  g_hash_table_remove_all(spin->atoms_normalized);
+  if(self)
+    {
+      g_hash_table_insert(spin->atoms_raw,self->raw,self);
+      g_hash_table_insert(spin->atoms_utf8,g_strdup(self->utf8),self);
+      g_hash_table_insert(spin->atoms_normalized,(gchar*) self->normalized,
+			  (gchar*) self->normalized);
+    }
+}
+
+static SpinAtom* spin_atom_new(SpinData* spin,gchar* raw,gchar* utf8)
+{
+  PurpleAccount* account = purple_connection_get_account(spin->gc);
+  SpinAtom* atom = g_new(SpinAtom,1);
+  const gchar* normalized = purple_normalize(account,utf8);
+  gchar* interned = g_hash_table_lookup(spin->atoms_normalized,normalized);
+
+  if(!interned)
+    {
+      interned = g_strdup(normalized);
+      g_hash_table_insert(spin->atoms_normalized,interned,interned);
+    }
+
+  atom->raw = raw;
+  atom->utf8 = utf8;
+  atom->normalized = interned;
+  g_hash_table_insert(spin->atoms_raw,raw,atom);
+  g_hash_table_insert(spin->atoms_utf8,g_strdup(utf8),atom);
+  return atom;
+}
+
+SpinAtom* spin_atom_raw(SpinData* spin,const gchar* raw,gsize len)
+{
+  SpinAtom* atom;
+
+  g_return_val_if_fail(raw,NULL);
+
+  /* fields are NUL terminated in place, so raw can be looked up as is */
+  if((atom = g_hash_table_lookup(spin->atoms_raw,raw)))
+    return atom;
+  return spin_atom_new(spin,g_strndup(raw,len),
+		       spin_latin9_to_utf8(raw,len));
+}
+
+SpinAtom* spin_atom_utf8(SpinData* spin,const gchar* utf8)
+{
+  SpinAtom* atom;
+  gchar* raw;
+
+  g_return_val_if_fail(utf8,NULL);
+
+  if((atom = g_hash_table_lookup(spin->atoms_utf8,utf8)))
+    return atom;
+  if(!(raw = spin_utf8_to_latin9(utf8,-1)))
+    return NULL;
+  if((atom = g_hash_table_lookup(spin->atoms_raw,raw)))
+    {
+      g_free(raw);
+      g_hash_table_insert(spin->atoms_utf8,g_strdup(utf8),atom);
+      return atom;
+    }
+  return spin_atom_new(spin,raw,g_strdup(utf8));
+}
@@ -0,0 +1,43 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef SPIN_ATOM_H_
+#define SPIN_ATOM_H_
+
+#include "spin.h"
+
+/* valid until the next line or streamed list part is parsed */
+struct _SpinAtom
+{
+  gchar* raw;
+  gchar* utf8;
+  const gchar* normalized; /* interned, compare pointers */
+};
+
+void spin_atoms_init(SpinData* spin);
+void spin_atoms_free(SpinData* spin);
+void spin_atoms_trim(SpinData* spin);
+
+SpinAtom* spin_atom_raw(SpinData* spin,const gchar* raw,gsize len);
+/* NULL without an ISO-8859-15 form */
+SpinAtom* spin_atom_utf8(SpinData* spin,const gchar* utf8);
+
+static inline gboolean spin_atom_is_self(SpinData* spin,const SpinAtom* atom)
+{
+  return atom && spin->self && atom->normalized == spin->self->normalized;
+}
+
+#endif
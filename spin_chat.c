@@ -19,24 +19,11 @@
 
 #include "prpl.h"
 #include "debug.h"
+#include "server.h"
+#include "spin_proto.h"
+#include "spin_atom.h"
 #include <string.h>
 
-gchar* spin_encode_room(const gchar* room)
-{
-  gsize bytes_in,bytes_out,len = strlen(room);
-  GError* error = NULL;
-  gchar* out = g_convert(room,len,"ISO-8859-15","UTF-8",&bytes_in,&bytes_out,
-			 &error);
-  if(error || bytes_in != len)
-    {
-      g_error_free(error);
-      if(out)
-	g_free(out);
-      return NULL;
-    }
-  return out;
-}
-
 GList* spin_chat_info(PurpleConnection* gc)
 {
   GList* r = NULL;
@@ -79,7 +66,7 @@ PurpleRoomlist* spin_roomlist_get_list(PurpleConnection* gc)
 
   purple_roomlist_set_fields(spin->roomlist,fields);
 
-  spin_write_command(spin,'l',NULL);
+  spin_send_room_list(spin);
   purple_roomlist_set_in_progress(spin->roomlist,TRUE);
 
   return spin->roomlist;
@@ -106,8 +93,7 @@ void spin_chat_join(PurpleConnection* gc,GHashTable* data)
 {
   SpinData* spin = (SpinData*) gc->proto_data;
   gchar* room_name = g_hash_table_lookup(data,"room");
-  gchar* encoded_room_name = NULL;
-  PurpleAccount* account = purple_connection_get_account(gc);
+  SpinAtom* atom;
 
   if(strchr(room_name,'#'))
     {
@@ -118,7 +104,7 @@ void spin_chat_join(PurpleConnection* gc,GHashTable* data)
       return;
     }
 
-  if(!(encoded_room_name = spin_encode_room(room_name)))
+  if(!(atom = spin_atom_utf8(spin,room_name)))
     {
       purple_notify_error(gc,_("Invalid room name"),
 			  _("Room name contains invalid characters"),
@@ -127,11 +113,9 @@ void spin_chat_join(PurpleConnection* gc,GHashTable* data)
       return;
     }
 
-  g_hash_table_insert(spin->pending_joins,
-		      g_strdup(purple_normalize(account,room_name)),
+  g_hash_table_insert(spin->pending_joins,g_strdup(atom->normalized),
 		      GINT_TO_POINTER(1));
-  spin_write_command(spin,'c',encoded_room_name,NULL);
-  g_free(encoded_room_name);
+  spin_send_join(spin,atom->raw);
 }
 
 void spin_chat_leave(PurpleConnection* gc,gint id)
@@ -144,14 +128,11 @@ void spin_chat_leave(PurpleConnection* gc,gint id)
   if(!conv)
     return;
 
-  PurpleAccount* account = purple_connection_get_account(gc);
-  const gchar* name = purple_conversation_get_name(conv);
-  gchar* name_2;
-  if(!(name_2 = spin_encode_room(name)))
+  SpinAtom* atom = spin_atom_utf8(spin,purple_conversation_get_name(conv));
+  if(!atom)
     return;
-  g_hash_table_remove(spin->pending_joins,purple_normalize(account,name));
-  spin_write_command(spin,'d',name_2,NULL);
-  g_free(name_2);
+  g_hash_table_remove(spin->pending_joins,atom->normalized);
+  spin_send_leave(spin,atom->raw);
 }
 
 gchar* spin_get_chat_name(GHashTable* data)
@@ -167,29 +148,19 @@ int spin_chat_send(PurpleConnection* gc,int id,const gchar* msg,
   if(!conv)
     return -1;
 
-  const gchar* room = purple_conversation_get_name(conv);
-  gchar* room_2;
-  if(!(room_2 = spin_encode_room(room)))
+  SpinAtom* atom = spin_atom_utf8(spin,purple_conversation_get_name(conv));
+  if(!atom)
     return -1;
-  gchar* msg_2 = spin_convert_out_text(msg);
-  gchar* ty = "a";
-  if(purple_message_meify(msg_2,-1))
-    ty = "c";
-
-  spin_write_command(spin,'g',room_2,ty,msg_2,NULL);
-
-  g_free(room_2);
-  g_free(msg_2);
+  spin_send_chat_say(spin,atom->raw,msg);
 
   return 1;
 }
 
 void spin_chat_set_room_away(SpinData* spin,const gchar* name,gboolean away)
 {
-  gchar* encoded_name = spin_encode_user(name);
-  g_return_if_fail(encoded_name);
-  spin_write_command(spin,'g',encoded_name,"0","away",away ? "1" : "0",NULL);
-  g_free(encoded_name);
+  SpinAtom* atom = spin_atom_utf8(spin,name);
+  g_return_if_fail(atom);
+  spin_send_chat_away(spin,atom->raw,"0","away",away ? "1" : "0");
 }
 
 
@@ -201,3 +172,140 @@ void spin_chat_set_room_status(SpinData* spin,const gchar* room,PurpleStatus* st
     || (primitive == PURPLE_STATUS_EXTENDED_AWAY);
   spin_chat_set_room_away(spin,room,away);
 }
+
+typedef struct
+{
+  gboolean leave;
+  gboolean quiet; /* entries of a chatter list, not announced as joins */
+  gchar* reason;
+  GList* users; /* newest first */
+  GList* flags;
+} SpinMemberUpdates;
+
+void spin_chat_member_updates_free(gpointer data)
+{
+  SpinMemberUpdates* updates = (SpinMemberUpdates*) data;
+  GList* i;
+
+  for(i = updates->users; i; i = i->next)
+    g_free(i->data);
+  g_list_free(updates->users);
+  g_list_free(updates->flags);
+  g_free(updates->reason);
+  g_free(updates);
+}
+
+static void spin_chat_commit_members(SpinData* spin,gint id,
+				     SpinMemberUpdates* updates)
+{
+  PurpleConversation* conv = purple_find_chat(spin->gc,id);
+  if(!conv)
+    return;
+
+  updates->users = g_list_reverse(updates->users);
+  updates->flags = g_list_reverse(updates->flags);
+  if(updates->leave)
+    purple_conv_chat_remove_users(PURPLE_CONV_CHAT(conv),updates->users,
+				  updates->reason);
+  else
+    purple_conv_chat_add_users(PURPLE_CONV_CHAT(conv),updates->users,NULL,
+			       updates->flags,!updates->quiet);
+}
+
+static void spin_chat_queue_member(SpinData* spin,PurpleConversation* conv,
+				   const gchar* user,gboolean leave,
+				   gboolean quiet,
+				   PurpleConvChatBuddyFlags flags,
+				   const gchar* reason)
+{
+  gint id = purple_conv_chat_get_id(PURPLE_CONV_CHAT(conv));
+  SpinMemberUpdates* updates =
+    g_hash_table_lookup(spin->member_updates,GINT_TO_POINTER(id));
+
+  /* a run only holds one kind of update, so the order is kept */
+  if(updates && (updates->leave != leave || updates->quiet != quiet
+		 || g_strcmp0(updates->reason,reason) != 0))
+    {
+      spin_chat_commit_members(spin,id,updates);
+      g_hash_table_remove(spin->member_updates,GINT_TO_POINTER(id));
+      updates = NULL;
+    }
+
+  if(!updates)
+    {
+      updates = g_new0(SpinMemberUpdates,1);
+      updates->leave = leave;
+      updates->quiet = quiet;
+      updates->reason = g_strdup(reason);
+      g_hash_table_insert(spin->member_updates,GINT_TO_POINTER(id),updates);
+    }
+
+  updates->users = g_list_prepend(updates->users,g_strdup(user));
+  updates->flags = g_list_prepend(updates->flags,GINT_TO_POINTER(flags));
+}
+
+void spin_chat_queue_join(SpinData* spin,PurpleConversation* conv,
+			  const gchar* user,PurpleConvChatBuddyFlags flags)
+{
+  spin_chat_queue_member(spin,conv,user,FALSE,FALSE,flags,NULL);
+}
+
+void spin_chat_queue_chatter(SpinData* spin,PurpleConversation* conv,
+			     const gchar* user,PurpleConvChatBuddyFlags flags)
+{
+  spin_chat_queue_member(spin,conv,user,FALSE,TRUE,flags,NULL);
+}
+
+void spin_chat_queue_leave(SpinData* spin,PurpleConversation* conv,
+			   const gchar* user,const gchar* reason)
+{
+  spin_chat_queue_member(spin,conv,user,TRUE,FALSE,PURPLE_CBFLAGS_NONE,
+			 reason);
+}
+
+static gboolean spin_chat_commit_members_cb(gpointer key,gpointer value,
+					    gpointer userp)
+{
+  spin_chat_commit_members((SpinData*) userp,GPOINTER_TO_INT(key),
+			   (SpinMemberUpdates*) value);
+  return TRUE;
+}
+
+void spin_chat_flush_members(SpinData* spin,PurpleConversation* conv)
+{
+  if(!g_hash_table_size(spin->member_updates))
+    return;
+
+  if(!conv)
+    {
+      g_hash_table_foreach_remove(spin->member_updates,
+				  spin_chat_commit_members_cb,spin);
+      return;
+    }
+
+  gint id = purple_conv_chat_get_id(PURPLE_CONV_CHAT(conv));
+  SpinMemberUpdates* updates =
+    g_hash_table_lookup(spin->member_updates,GINT_TO_POINTER(id));
+  if(updates)
+    {
+      spin_chat_commit_members(spin,id,updates);
+      g_hash_table_remove(spin->member_updates,GINT_TO_POINTER(id));
+    }
+}
+
+void spin_chat_notfound(SpinData* spin,const gchar* room,const gchar* raw_room)
+{
+  purple_debug_info("spin","room not found: %s\n",room);
+  /* try to leave the room */
+  spin_send_leave(spin,raw_room);
+}
+
+PurpleConversation* spin_chat_find(SpinData* spin,const gchar* room)
+{
+  PurpleAccount* account = purple_connection_get_account(spin->gc);
+  PurpleConversation* conv =
+    purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT,room,account);
+  if(conv)
+    spin_chat_flush_members(spin,conv);
+  return conv;
+}
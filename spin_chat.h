@@ -29,9 +29,28 @@ gchar* spin_get_chat_name(GHashTable* data);
 void spin_chat_leave(PurpleConnection* gc,gint id);
 int spin_chat_send(PurpleConnection* gc,int id,const gchar* msg,
 		    PurpleMessageFlags flags);
-gchar* spin_encode_room(const gchar* room);
 
 void spin_chat_set_room_away(SpinData* spin,const gchar* room,gboolean away);
 void spin_chat_set_room_status(SpinData* spin,const gchar* room,PurpleStatus* status);
 
+/* joins and leaves of other users are collected per room and committed
+   with one purple_conv_chat_add_users/remove_users call */
+void spin_chat_queue_join(SpinData* spin,PurpleConversation* conv,
+			  const gchar* user,PurpleConvChatBuddyFlags flags);
+/* like a join, but for an entry of the chatter list */
+void spin_chat_queue_chatter(SpinData* spin,PurpleConversation* conv,
+			     const gchar* user,PurpleConvChatBuddyFlags flags);
+void spin_chat_queue_leave(SpinData* spin,PurpleConversation* conv,
+			   const gchar* user,const gchar* reason);
+/* commits the queued updates of conv, or of all rooms if conv is NULL */
+void spin_chat_flush_members(SpinData* spin,PurpleConversation* conv);
+void spin_chat_member_updates_free(gpointer data);
+
+/* everything shown in a room has to come after the member updates
+   queued for it, so this commits them before handing out the
+   conversation */
+PurpleConversation* spin_chat_find(SpinData* spin,const gchar* room);
+/* leaves a room the server sent something for but we do not know */
+void spin_chat_notfound(SpinData* spin,const gchar* room,const gchar* raw_room);
+
 #endif
@@ -20,6 +20,8 @@
 #include "spin_cmds.h"
 #include "spin_privacy.h"
 #include "spin_parse.h"
+#include "spin_proto.h"
+#include "spin_atom.h"
 
 typedef void (*SpinCmdFunc)(PurpleConversation* conv,
 			    SpinData* spin,const gchar** args,
@@ -49,6 +51,7 @@ static PurpleCmdRet spin_handle_command(PurpleConversation* conv,
   gchar** f_args = g_new0(gchar*,strlen(i->fmt)+1),
     **cur_f_arg = f_args,**cur_arg = args;
   const gchar* cur_fmt = i->fmt;
+  SpinAtom* atom;
 
   while(*cur_fmt)
     {
@@ -62,12 +65,11 @@ static PurpleCmdRet spin_handle_command(PurpleConversation* conv,
 	    }
 	case 'U': /* unencoded user name */
 	  /* check for valid user name */
-	  if(!(*cur_f_arg = spin_encode_user(*cur_arg)))
+	  if(!spin_atom_utf8(spin,*cur_arg))
 	    {
 	      *error = g_strdup(_("Invalid character in room or user name"));
 	      goto arg_fail;
 	    }
-	  g_free(*cur_f_arg);
 	  *cur_f_arg++ = g_strstrip(g_strdup(*cur_arg++));
 	  break;
 	case 'r': /* encoded room argument */
@@ -77,21 +79,22 @@ static PurpleCmdRet spin_handle_command(PurpleConversation* conv,
 	      goto arg_fail;
 	    }
 	case 'u': /* encoded user argument */
-	  *cur_f_arg = g_strstrip(spin_encode_user(*cur_arg++));
-	  if(!*cur_f_arg++)
+	  if(!(atom = spin_atom_utf8(spin,*cur_arg++)))
 	    {
 	      *error = g_strdup(_("Invalid character in room or user name"));
 	      goto arg_fail;
 	    }
+	  *cur_f_arg++ = g_strstrip(g_strdup(atom->raw));
 	  break;
 	case 'n': /* encoded conversation name */
-	  *cur_f_arg = spin_encode_user(purple_conversation_get_name(conv));
-	  if(!*cur_f_arg++)
+	  atom = spin_atom_utf8(spin,purple_conversation_get_name(conv));
+	  if(!atom)
 	    {
 	      *error = g_strdup(_("Invalid conversation name, "
 				  "something went wrong here..."));
 	      goto arg_fail;
 	    }
+	  *cur_f_arg++ = g_strdup(atom->raw);
 	  break;
 	case 'N': /* unencoded conversation name */
 	  *cur_f_arg++ = g_strdup(purple_conversation_get_name(conv));
@@ -101,7 +104,9 @@ static PurpleCmdRet spin_handle_command(PurpleConversation* conv,
 	}
     }
 
+  spin_write_cork(spin);
   i->func(conv,spin,(const gchar**) f_args,i->userp,error);
+  spin_write_uncork(spin);
 
  arg_fail:
   g_strfreev(f_args);
@@ -228,23 +233,23 @@ void spin_cmd_srvkick(PurpleConversation* conv,
 		      SpinData* spin,const gchar** args,
 		      gpointer userp,gchar** error)
 {
-  spin_write_command(spin,'1',args[0],NULL);
+  spin_send_srv_kick(spin,args[0]);
 }
 
 void spin_cmd_srvkickban(PurpleConversation* conv,
 			 SpinData* spin,const gchar** args,
 			 gpointer userp,gchar** error)
 {
-  spin_write_command(spin,'2',"c",args[0],NULL);
-  spin_write_command(spin,'2',"a",args[0],NULL);
-  spin_write_command(spin,'1',args[0],NULL);
+  spin_send_srv_ban(spin,"c",args[0]);
+  spin_send_srv_ban(spin,"a",args[0]);
+  spin_send_srv_kick(spin,args[0]);
 }
 
 void spin_cmd_srvmute(PurpleConversation* conv,
 		      SpinData* spin,const gchar** args,
 		      gpointer userp,gchar** error)
 {
-  spin_write_command(spin,'E',args[0],NULL);
+  spin_send_srv_mute(spin,args[0]);
 }
 
 
@@ -252,79 +257,85 @@ void spin_cmd_banlist(PurpleConversation* conv,
 		      SpinData* spin,const gchar** args,
 		      gpointer userp,gchar** error)
 {
-  spin_write_command(spin,'t',args[0],"1","",NULL);
+  spin_send_room_query(spin,args[0],"1","");
 }
 
 void spin_cmd_unreglock(PurpleConversation* conv,
 			 SpinData* spin,const gchar** args,
 			gpointer userp,gchar** error)
 {
-  spin_write_command(spin,'t',args[0],"i","",NULL);
+  spin_send_room_query(spin,args[0],"i","");
 }
 
 void spin_cmd_room_flags(PurpleConversation* conv,
 			 SpinData* spin,const gchar** args,
 			 gpointer userp,gchar** error)
 {
-  spin_write_command(spin,'|',args[0],userp,args[1],"",NULL);
+  spin_send_room_flags(spin,args[0],userp,args[1],"");
 }
 
 void spin_cmd_kick(PurpleConversation* conv,
 			 SpinData* spin,const gchar** args,
 			 gpointer userp,gchar** error)
 {
-  spin_write_command(spin,'f',args[1],args[0],NULL);
+  spin_send_kick(spin,args[1],args[0]);
 }
 
 void spin_cmd_unban(PurpleConversation* conv,
 			 SpinData* spin,const gchar** args,
 			 gpointer userp,gchar** error)
 {
-  spin_write_command(spin,'t',args[0],"E",args[1],NULL);
+  spin_send_room_query(spin,args[0],"E",args[1]);
 }
 
 void spin_cmd_kickban(PurpleConversation* conv,
 			 SpinData* spin,const gchar** args,
 			 gpointer userp,gchar** error)
 {
-  spin_write_command(spin,'t',args[0],"e","a",args[1],NULL);
-  spin_write_command(spin,'f',args[1],args[0],NULL);
+  spin_send_room_ban(spin,args[0],"e","a",args[1]);
+  spin_send_kick(spin,args[1],args[0]);
 }
 
 void spin_cmd_warn(PurpleConversation* conv,
 			 SpinData* spin,const gchar** args,
 			 gpointer userp,gchar** error)
 {
-  spin_write_command(spin,'g',args[0],"0","warn",args[1],args[2],
-		     NULL);
+  spin_send_chat_warn(spin,args[0],"0","warn",args[1],args[2]);
+}
+
+/* an ip address, the last part may be '*' */
+static gboolean spin_valid_ban(const gchar* p)
+{
+  guint part;
+
+  for(part = 0; part < 4; ++part)
+    {
+      if(part > 0 && *p++ != '.')
+	return FALSE;
+      if(part == 3 && *p == '*')
+	return p[1] == '\0';
+      if(!g_ascii_isdigit(*p))
+	return FALSE;
+      while(g_ascii_isdigit(*p))
+	++p;
+    }
+  return *p == '\0';
 }
 
 void spin_cmd_ban(PurpleConversation* conv,
 			 SpinData* spin,const gchar** args,
 			 gpointer userp,gchar** error)
 {
-  static GRegex* valid_ban_re = NULL;
-  if(!valid_ban_re)
-    {
-      GError* error = NULL;
-      valid_ban_re = g_regex_new("^\\d+\\.\\d+\\.\\d+(?:\\.(?:\\d+|\\*))$",
-				 G_REGEX_OPTIMIZE,0,&error);
-      g_assert(error == NULL);
-    }
-  
-  if(!g_regex_match(valid_ban_re,args[0],0,NULL))
+  if(!spin_valid_ban(args[0]))
     {
       *error = g_strdup(_("Invalid ban expression"));
       return;
     }
 
-  const gchar* room = purple_conversation_get_name(conv);
-  gchar* encoded_room = spin_encode_user(room);
-  g_return_if_fail(encoded_room);
-
-  spin_write_command(spin,'t',encoded_room,"e","0",args[0],NULL);
+  SpinAtom* room = spin_atom_utf8(spin,purple_conversation_get_name(conv));
+  g_return_if_fail(room);
 
-  g_free(encoded_room);
+  spin_send_room_ban(spin,room->raw,"e","0",args[0]);
 }
 
 typedef struct
@@ -338,38 +349,33 @@ void spin_cmd_emote(PurpleConversation* conv,
 		    gpointer userp,gchar** error)
 {
   EmoteInfo* info = (EmoteInfo*) userp;
-  gchar* encoded_conv_name =
-    spin_encode_user(purple_conversation_get_name(conv));
-  g_return_if_fail(encoded_conv_name);
+  SpinAtom* atom = spin_atom_utf8(spin,purple_conversation_get_name(conv));
+  g_return_if_fail(atom);
+  const gchar* encoded_conv_name = atom->raw;
   
   gchar* send_text = g_strdup_printf(info->fmt,args[0]);
-  gchar* out_text = NULL;
+  const gchar* out_text;
 
   if(purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_IM)
     {
       PurpleAccount* account = purple_connection_get_account(spin->gc);
       const gchar* user = purple_account_get_username(account);
-      out_text = spin_write_chat(*info->ty,user,send_text);
+      out_text = spin_write_chat(spin->render,*info->ty,user,send_text);
 
-      spin_write_command(spin,'h',encoded_conv_name,"0",info->ty,send_text,
-			 NULL);
+      spin_send_msg(spin,encoded_conv_name,"0",info->ty,send_text);
       purple_conv_im_write(PURPLE_CONV_IM(conv),
 			   purple_connection_get_display_name(spin->gc),
 			   out_text,PURPLE_MESSAGE_SEND,time(NULL));
     }
   else if(purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_CHAT)
     {
-      const gchar* user = purple_conv_chat_get_nick(PURPLE_CONV_CHAT(conv));
-      out_text = spin_write_chat(*info->ty,user,send_text);
-      
-      spin_write_command(spin,'g',encoded_conv_name,info->ty,send_text,NULL);
+      spin_send_chat_msg(spin,encoded_conv_name,info->ty,send_text);
       /* serv_got_chat_in(spin->gc,purple_conv_chat_get_id(PURPLE_CONV_CHAT(conv)), */
       /* 		       purple_conv_chat_get_nick(PURPLE_CONV_CHAT(conv)), */
       /* 		       PURPLE_MESSAGE_SEND,out_text,time(NULL)); */
     }
 
   g_free(send_text);
-  g_free(out_text);
 }
 
 void spin_register_commands()
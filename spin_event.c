@@ -0,0 +1,640 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "spin_event.h"
+#include "spin_friends.h"
+
+#include "debug.h"
+#include "connection.h"
+#include "server.h"
+#include "spin_notify.h"
+#include "spin_mail.h"
+#include "spin_chat.h"
+#include "spin_prefs.h"
+#include "spin_login.h"
+#include "spin_proto.h"
+#include "spin_text.h"
+#include "spin_highlight.h"
+
+#include <string.h>
+
+static const gchar* leave_reasons[] =
+  {
+    N_("left the room"),
+    N_("kicked by %3$s%1$.0s%2$.0s"),
+    N_("kicked by the server"),
+    N_("you are banned"),
+    N_("room %2$s is currently full%1$.0s"),
+    N_("room %2$s is closed%1$.0s"),
+    N_("creation of new rooms is not allowed"),
+    N_("room is for registered users only"),
+    N_("room is for VIP users only"),
+    N_("room could not be created: too many rooms"),
+    N_("room could not be created: room name is illegal"),
+    N_("too long inactive"),
+    N_("kicked of the server")
+  };
+
+static void spin_apply_connected(SpinData* spin,SpinEvent* ev)
+{
+  PurpleAccount* account = purple_connection_get_account(spin->gc);
+  purple_debug_info("spin","connected\n");
+  spin_connect_add_state(spin,SPIN_STATE_GOT_CHAT_LOGIN);
+
+  spin_set_status(account,purple_account_get_active_status(account));
+
+  purple_connection_update_progress(spin->gc,Q_("Progress|Receiving Prefs"),
+				    1,4);
+  spin_receive_friends(spin);
+  spin_check_mail(spin);
+  /*spin_sync_privacy_lists(spin);*/
+  spin_load_prefs(spin);
+}
+
+static void spin_apply_disconnected(SpinData* spin,SpinEvent* ev)
+{
+  purple_debug_info("spin","disconnected\n");
+  if(purple_connection_get_state(spin->gc) == PURPLE_CONNECTING)
+    purple_connection_error_reason
+      (spin->gc,PURPLE_CONNECTION_ERROR_AUTHENTICATION_FAILED,
+       _("chat server denied login"));
+  else
+    ; //purple_connection_set_state(spin->gc,PURPLE_DISCONNECTED);
+}
+
+static void spin_apply_pong(SpinData* spin,SpinEvent* ev)
+{
+  if(spin->ping_timeout_handle)
+    {
+      purple_timeout_remove(spin->ping_timeout_handle);
+      spin->ping_timeout_handle = 0;
+    }
+}
+
+static void spin_apply_private_msg(SpinData* spin,SpinEvent* ev)
+{
+  serv_got_im(spin->gc,ev->user,
+	      spin_write_chat(spin->render,ev->kind,ev->user,ev->text),0,
+	      time(NULL));
+}
+
+static void spin_apply_away_msg(SpinData* spin,SpinEvent* ev)
+{
+  PurpleAccount* account = purple_connection_get_account(spin->gc);
+  PurpleConversation* conv =
+    purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM,ev->user,
+					  account);
+  if(!conv)
+    return;
+
+  const gchar* setting = purple_account_get_string(account,"show-away",
+						   "always");
+  if(g_strcmp0(setting,"never") == 0)
+    return;
+  if(g_strcmp0(setting,"non-buddys") == 0
+     && purple_find_buddy(account,ev->user))
+    return;
+
+  g_string_truncate(spin->render,0);
+  spin_text_escape(spin->render,ev->text ? ev->text : "",-1);
+  purple_conv_im_write(PURPLE_CONV_IM(conv),ev->user,spin->render->str,
+		       PURPLE_MESSAGE_AUTO_RESP,time(NULL));
+}
+
+static void spin_apply_ping_request(SpinData* spin,SpinEvent* ev)
+{
+  SpinAtom* atom = spin_atom_utf8(spin,ev->user);
+  if(!atom)
+    return;
+  spin_send_msg(spin,atom->raw,"2","0","pong");
+}
+
+static void spin_apply_nospam(SpinData* spin,SpinEvent* ev)
+{
+  purple_notify_warning(spin->gc,"spam warning",
+			ev->text ? ev->text : "no spam!",ev->user);
+}
+
+static void spin_apply_game_invite(SpinData* spin,SpinEvent* ev)
+{
+  spin_notify_game_invite(spin,ev->user,ev->text,ev->extra,ev->id,
+			  ev->password);
+}
+
+static void spin_apply_status(SpinData* spin,SpinEvent* ev)
+{
+  PurpleAccount* account = purple_connection_get_account(spin->gc);
+  PurpleBuddy *buddy = purple_find_buddy(account,ev->user);
+  if(!buddy)
+    return;
+
+  if(ev->kind == 'i')
+    {
+      purple_prpl_got_user_status(account,ev->user,"away",
+				  "message",ev->text ? ev->text : "",NULL);
+    }
+  /* the javascript code treats away and online seperate, so receiving an
+     online message does not reset away state */
+  else if(ev->kind == 'j'
+	  || (ev->kind == 'g'
+	      && !purple_presence_is_online(purple_buddy_get_presence(buddy))))
+    {
+      purple_prpl_got_user_status(account,ev->user,"available",NULL);
+    }
+  else if(ev->kind == 'h')
+    {
+      purple_prpl_got_user_status(account,ev->user,"offline",NULL);
+    }
+
+  g_hash_table_insert(spin->updated_status_list,
+		      g_strdup(ev->user_atom->normalized),
+		      GINT_TO_POINTER(1));
+}
+
+static void spin_apply_notify(SpinData* spin,SpinEvent* ev)
+{
+  switch(ev->kind)
+    {
+    case 'l': /* reload friends */
+      spin_receive_friends(spin);
+      break;
+    case 'a': /* new mail */
+      spin_check_mail(spin);
+      break;
+    case 'b': /* new guestbook */
+      spin_notify_guestbook_entry(spin,ev->user);
+      break;
+    case 'c': /* new gift */
+      spin_notify_gift(spin,ev->user);
+      break;
+    }
+}
+
+static void spin_apply_join(SpinData* spin,SpinEvent* ev)
+{
+  PurpleAccount* account = purple_connection_get_account(spin->gc);
+  static int id = 1;
+
+  if(spin_atom_is_self(spin,ev->user_atom))
+    {
+      const gchar* normalized_room = ev->room_atom->normalized;
+      g_hash_table_remove(spin->pending_joins,normalized_room);
+      serv_got_joined_chat(spin->gc,id++,normalized_room);
+      spin_send_chatters(spin,ev->raw_room);
+      spin_send_room_info(spin,ev->raw_room);
+      spin_chat_set_room_status(spin,ev->room,
+				purple_account_get_active_status(account));
+      return;
+    }
+
+  PurpleConversation* conv =
+    purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT,ev->room,
+					  account);
+  if(!conv)
+    {
+      spin_chat_notfound(spin,ev->room,ev->raw_room);
+      return;
+    }
+  spin_chat_queue_join(spin,conv,ev->user,ev->flags);
+}
+
+static void spin_apply_leave(SpinData* spin,SpinEvent* ev)
+{
+  PurpleAccount* account = purple_connection_get_account(spin->gc);
+  gchar* reason = NULL;
+  const gchar* normalized_room = ev->room_atom->normalized;
+
+  if('B' <= ev->kind && ev->kind <= 'M')
+    reason =
+      g_strdup_printf(g_dgettext(GETTEXT_PACKAGE,leave_reasons[ev->kind-'A']),
+		      ev->user,ev->room,ev->other,ev->extra);
+
+  if(g_hash_table_lookup(spin->pending_joins,normalized_room))
+    {
+      GHashTable* table = g_hash_table_new(g_str_hash,g_str_equal);
+      g_hash_table_insert(table,"room",(gchar*) normalized_room);
+      purple_serv_got_join_chat_failed(spin->gc,table);
+      g_hash_table_unref(table);
+
+      gchar* head = g_strdup_printf(_("cannot join room %s"),ev->room);
+      purple_notify_error(spin->gc,head,
+			  reason ? reason : _("no known reason"),NULL);
+      g_free(head);
+      g_hash_table_remove(spin->pending_joins,normalized_room);
+
+      goto exit;
+    }
+
+  PurpleConversation* conv =
+    purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT,ev->room,
+					  account);
+  if(spin_atom_is_self(spin,ev->user_atom))
+    {
+      if(conv)
+	{
+	  spin_chat_flush_members(spin,conv);
+	  gchar* msg = g_strdup_printf(_("You have left the room%s%s%s"),
+				       reason ? " (" : "",
+				       reason ? reason : "",
+				       reason ? ")" : "");
+	  purple_conv_chat_write(PURPLE_CONV_CHAT(conv),"",msg,
+				 PURPLE_MESSAGE_SYSTEM|PURPLE_MESSAGE_NICK,
+				 time(NULL));
+	  serv_got_chat_left
+	    (spin->gc,purple_conv_chat_get_id(PURPLE_CONV_CHAT(conv)));
+	  g_free(msg);
+	}
+    }
+  else
+    {
+      if(conv)
+	spin_chat_queue_leave(spin,conv,ev->user,reason);
+      else
+	spin_chat_notfound(spin,ev->room,ev->raw_room);
+    }
+
+ exit:
+  g_free(reason);
+}
+
+static void spin_apply_chat_msg(SpinData* spin,SpinEvent* ev)
+{
+  gchar* m;
+  PurpleConversation* conv = spin_chat_find(spin,ev->room);
+  if(!conv)
+    {
+      spin_chat_notfound(spin,ev->room,ev->raw_room);
+      return;
+    }
+
+  /* the text is only decoded for rooms we are in */
+  if(!(m = spin_field_text(spin,ev->body)))
+    return;
+
+  PurpleMessageFlags flags = 0;
+  if(spin_highlight_match(spin->highlight,m)
+     || (spin->nick_regex && g_regex_match(spin->nick_regex,m,0,NULL)))
+    flags |= PURPLE_MESSAGE_NICK;
+
+  serv_got_chat_in(spin->gc,purple_conv_chat_get_id(PURPLE_CONV_CHAT(conv)),
+		   ev->user,flags,
+		   spin_write_chat(spin->render,ev->kind,ev->user,m),
+		   time(NULL));
+}
+
+static void spin_apply_warn(SpinData* spin,SpinEvent* ev)
+{
+  gchar* text;
+  PurpleConversation* conv = spin_chat_find(spin,ev->room);
+  if(!conv)
+    {
+      spin_chat_notfound(spin,ev->room,ev->raw_room);
+      return;
+    }
+
+  /* user has been warned by other */
+  if(spin_atom_is_self(spin,ev->user_atom))
+    {
+      if(ev->text && *ev->text)
+	text = g_strdup_printf(_("You have been warned by %s: %s"),
+			       ev->other,ev->text);
+      else
+	text = g_strdup_printf(_("You have been warned by %s"),ev->other);
+      g_string_assign(spin->render,"<span style=\"color:red\">");
+      spin_text_escape(spin->render,text,-1);
+      g_string_append(spin->render,"</span>");
+      purple_conv_chat_write(PURPLE_CONV_CHAT(conv),ev->other,
+			     spin->render->str,
+			     PURPLE_MESSAGE_NICK|PURPLE_MESSAGE_SYSTEM,
+			     time(NULL));
+    }
+  else
+    {
+      if(ev->text && *ev->text)
+	text = g_strdup_printf(_("%s has been warned by %s: %s"),
+			       ev->user,ev->other,ev->text);
+      else
+	text = g_strdup_printf(_("%s has been warned by %s"),ev->user,
+			       ev->other);
+      g_string_truncate(spin->render,0);
+      spin_text_escape(spin->render,text,-1);
+      purple_conv_chat_write(PURPLE_CONV_CHAT(conv),ev->other,
+			     spin->render->str,PURPLE_MESSAGE_SYSTEM,
+			     time(NULL));
+    }
+
+  g_free(text);
+}
+
+#if SPIN_USE_CBFLAGS_AWAY
+static void spin_apply_chat_away(SpinData* spin,SpinEvent* ev)
+{
+  PurpleConversation* conv = spin_chat_find(spin,ev->room);
+  if(!conv)
+    {
+      spin_chat_notfound(spin,ev->room,ev->raw_room);
+      return;
+    }
+
+  PurpleConvChatBuddyFlags flags =
+    purple_conv_chat_user_get_flags(PURPLE_CONV_CHAT(conv),ev->user);
+  if(ev->status)
+    flags |= PURPLE_CBFLAGS_AWAY;
+  else
+    flags &= ~PURPLE_CBFLAGS_AWAY;
+
+  purple_conv_chat_user_set_flags(PURPLE_CONV_CHAT(conv),ev->user,flags);
+}
+#endif
+
+static void spin_apply_msg_error(SpinData* spin,SpinEvent* ev)
+{
+  PurpleAccount* account = purple_connection_get_account(spin->gc);
+  purple_conv_present_error(ev->user,account,_("error sending message"));
+}
+
+static void spin_apply_chat_error(SpinData* spin,SpinEvent* ev)
+{
+  if(g_hash_table_lookup(spin->pending_joins,ev->room))
+    {
+      g_hash_table_remove(spin->pending_joins,ev->room);
+      
+      GHashTable* table = g_hash_table_new(g_str_hash,g_str_equal);
+      g_hash_table_insert(table,"room",(gpointer) ev->room);
+      purple_serv_got_join_chat_failed(spin->gc,table);
+      g_hash_table_unref(table);
+    }
+}
+
+static void spin_apply_roominfo(SpinData* spin,SpinEvent* ev)
+{
+  PurpleConversation* conv = spin_chat_find(spin,ev->room);
+  if(!conv)
+    {
+      spin_chat_notfound(spin,ev->room,ev->raw_room);
+      return;
+    }
+
+  if(ev->extra && *ev->extra)
+    {
+      gchar* text = g_strdup_printf("%s (%s)",ev->text,ev->extra);
+      purple_conv_chat_set_topic(PURPLE_CONV_CHAT(conv),NULL,text);
+      g_free(text);
+    }
+  else
+      purple_conv_chat_set_topic(PURPLE_CONV_CHAT(conv),NULL,ev->text);
+}
+
+static void spin_apply_usermode(SpinData* spin,SpinEvent* ev)
+{
+  gchar* formatted_msg;
+  PurpleConversation* conv = spin_chat_find(spin,ev->room);
+  if(!conv)
+    {
+      spin_chat_notfound(spin,ev->room,ev->raw_room);
+      return;
+    }
+
+  const gchar* msg = NULL;
+  PurpleConvChatBuddyFlags flags =
+    purple_conv_chat_user_get_flags(PURPLE_CONV_CHAT(conv),ev->user);
+
+  purple_debug_info("spin","flags was %u\n",flags);
+
+  switch(ev->kind)
+    {
+    case 'a':
+      flags |= PURPLE_CBFLAGS_HALFOP; 
+      msg = _("%2$s gives operator rights to %1$s");
+      break;
+    case 'A':
+      flags &= ~PURPLE_CBFLAGS_HALFOP; 
+      msg = _("%2$s removes operator rights from %1$s");
+      break;
+    case 'b':
+      flags |= PURPLE_CBFLAGS_VOICE; 
+      msg = _("%2$s gives voice to %1$s");
+      break;
+    case 'B':
+      flags &= ~PURPLE_CBFLAGS_VOICE; 
+      msg = _("%2$s removes voice from %1$s");
+      break;
+    }
+
+  purple_debug_info("spin","flags is %u\n",flags);
+
+  purple_conv_chat_user_set_flags(PURPLE_CONV_CHAT(conv),ev->user,flags);
+
+  if(msg)
+    {
+      formatted_msg = g_strdup_printf(msg,ev->user,ev->other);
+      g_string_truncate(spin->render,0);
+      spin_text_escape(spin->render,formatted_msg,-1);
+      purple_conv_chat_write(PURPLE_CONV_CHAT(conv),ev->user,
+			     spin->render->str,PURPLE_MESSAGE_SYSTEM,
+			     time(NULL));
+      g_free(formatted_msg);
+    }
+}
+
+static void spin_apply_roommode(SpinData* spin,SpinEvent* ev)
+{
+  gchar* msg = NULL;
+  PurpleConversation* conv = spin_chat_find(spin,ev->room);
+  if(!conv)
+    {
+      spin_chat_notfound(spin,ev->room,ev->raw_room);
+      return;
+    }
+
+  switch(ev->kind)
+    {
+    case 'e': /* banned */
+      msg = g_markup_printf_escaped(_("IP address %1$s has been banned by %2$s"),
+				    ev->extra,ev->user);
+      break;
+    case 'E': /* unbanned */
+      msg = g_markup_printf_escaped
+	(_("IP address %1$s's ban has been removed by %2$s"),ev->extra,
+	 ev->user);
+      break;
+    case 'i':
+      msg = g_strdup(_("The room locked for unregistered users"));
+      break;
+    }
+
+  if(!msg)
+    return;
+
+  purple_conv_chat_write(PURPLE_CONV_CHAT(conv),"",msg,
+			 PURPLE_MESSAGE_SYSTEM,time(NULL));
+  g_free(msg);
+}
+
+static void spin_apply_room_check(SpinData* spin,SpinEvent* ev)
+{
+  if(!spin_chat_find(spin,ev->room))
+    spin_chat_notfound(spin,ev->room,ev->raw_room);
+}
+
+static void spin_apply_list_begin(SpinData* spin,SpinEvent* ev)
+{
+  PurpleConversation* conv;
+
+  if(ev->kind == 'l')
+    {
+      ev->list->ignored = !spin->roomlist;
+      return;
+    }
+
+  if(!(conv = spin_chat_find(spin,ev->room)))
+    {
+      spin_chat_notfound(spin,ev->room,ev->raw_room);
+      ev->list->ignored = TRUE;
+      return;
+    }
+  ev->list->chat = purple_conv_chat_get_id(PURPLE_CONV_CHAT(conv));
+  if(ev->kind == 'n')
+    {
+      ev->list->text = g_string_new(_("Banned IP addresses:"));
+      g_string_append(ev->list->text,"<ul>");
+    }
+}
+
+static void spin_apply_list_entry(SpinData* spin,SpinEvent* ev)
+{
+  PurpleConversation* conv;
+  PurpleRoomlistRoom* room;
+
+  switch(ev->kind)
+    {
+    case 'j':
+      if((conv = purple_find_chat(spin->gc,ev->list->chat)))
+	spin_chat_queue_chatter(spin,conv,ev->user,ev->flags);
+      else
+	ev->list->ignored = TRUE;
+      break;
+    case 'l':
+      /* the room list might have been canceled in between */
+      if(!spin->roomlist)
+	{
+	  ev->list->ignored = TRUE;
+	  break;
+	}
+      room = purple_roomlist_room_new(PURPLE_ROOMLIST_ROOMTYPE_ROOM,ev->text,
+				      NULL);
+      purple_roomlist_room_add_field(spin->roomlist,room,ev->text);
+      purple_roomlist_room_add(spin->roomlist,room);
+      break;
+    case 'n':
+      g_string_append_len(ev->list->text,"<li>",4);
+      spin_text_escape(ev->list->text,ev->extra,-1);
+      g_string_append_len(ev->list->text,"</li>",5);
+      break;
+    }
+}
+
+static void spin_apply_list_end(SpinData* spin,SpinEvent* ev)
+{
+  PurpleConversation* conv = purple_find_chat(spin->gc,ev->list->chat);
+
+  switch(ev->kind)
+    {
+    case 'j':
+      if(conv)
+	spin_chat_flush_members(spin,conv);
+      break;
+    case 'l':
+      if(ev->list->ignored || !spin->roomlist)
+	break;
+      purple_roomlist_set_in_progress(spin->roomlist,FALSE);
+      purple_roomlist_unref(spin->roomlist);
+      spin->roomlist = NULL;
+      break;
+    case 'n':
+      if(!conv || !ev->list->text)
+	break;
+      g_string_append(ev->list->text,"</ul>");
+      purple_conv_chat_write(PURPLE_CONV_CHAT(conv),"",ev->list->text->str,
+			     PURPLE_MESSAGE_SYSTEM,time(NULL));
+      break;
+    }
+}
+
+static const struct
+{
+  void (*apply)(SpinData* spin,SpinEvent* ev);
+  const gchar* name;
+} spin_event_types[SPIN_EVENT_COUNT] =
+  {
+    [SPIN_EVENT_CONNECTED] = {spin_apply_connected,"connected"},
+    [SPIN_EVENT_DISCONNECTED] = {spin_apply_disconnected,"disconnected"},
+    [SPIN_EVENT_PONG] = {spin_apply_pong,"pong"},
+    [SPIN_EVENT_PRIVATE_MSG] = {spin_apply_private_msg,"private msg"},
+    [SPIN_EVENT_AWAY_MSG] = {spin_apply_away_msg,"away msg"},
+    [SPIN_EVENT_PING_REQUEST] = {spin_apply_ping_request,"ping request"},
+    [SPIN_EVENT_NOSPAM] = {spin_apply_nospam,"nospam"},
+    [SPIN_EVENT_GAME_INVITE] = {spin_apply_game_invite,"game invite"},
+    [SPIN_EVENT_STATUS] = {spin_apply_status,"status"},
+    [SPIN_EVENT_NOTIFY] = {spin_apply_notify,"notify"},
+    [SPIN_EVENT_JOIN] = {spin_apply_join,"join"},
+    [SPIN_EVENT_LEAVE] = {spin_apply_leave,"leave"},
+    [SPIN_EVENT_CHAT_MSG] = {spin_apply_chat_msg,"chat msg"},
+    [SPIN_EVENT_WARN] = {spin_apply_warn,"warn"},
+#if SPIN_USE_CBFLAGS_AWAY
+    [SPIN_EVENT_CHAT_AWAY] = {spin_apply_chat_away,"chat away"},
+#endif
+    [SPIN_EVENT_MSG_ERROR] = {spin_apply_msg_error,"msg error"},
+    [SPIN_EVENT_CHAT_ERROR] = {spin_apply_chat_error,"chat error"},
+    [SPIN_EVENT_ROOMINFO] = {spin_apply_roominfo,"room info"},
+    [SPIN_EVENT_USERMODE] = {spin_apply_usermode,"user mode"},
+    [SPIN_EVENT_ROOMMODE] = {spin_apply_roommode,"room mode"},
+    [SPIN_EVENT_ROOM_CHECK] = {spin_apply_room_check,"room check"},
+    [SPIN_EVENT_LIST_BEGIN] = {spin_apply_list_begin,"list begin"},
+    [SPIN_EVENT_LIST_ENTRY] = {spin_apply_list_entry,"list entry"},
+    [SPIN_EVENT_LIST_END] = {spin_apply_list_end,"list end"},
+  };
+
+void spin_event_apply(SpinData* spin,SpinEvent* ev)
+{
+  gint64 start;
+
+  g_return_if_fail(ev->type < SPIN_EVENT_COUNT);
+  if(!spin_event_types[ev->type].apply)
+    return;
+
+  spin->event_stats[ev->type].hits++;
+  if(!spin->profile)
+    {
+      spin_event_types[ev->type].apply(spin,ev);
+      return;
+    }
+  start = g_get_monotonic_time();
+  spin_event_types[ev->type].apply(spin,ev);
+  spin->event_stats[ev->type].usecs += g_get_monotonic_time() - start;
+}
+
+void spin_event_log_stats(SpinData* spin)
+{
+  guint i;
+
+  for(i = 0; i < SPIN_EVENT_COUNT; ++i)
+    if(spin->event_stats[i].hits)
+      purple_debug_misc("spin","event: %s: %u, %.1f ms\n",
+			spin_event_types[i].name,spin->event_stats[i].hits,
+			spin->event_stats[i].usecs / 1000.0);
+}
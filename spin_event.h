@@ -0,0 +1,59 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef SPIN_EVENT_H_
+#define SPIN_EVENT_H_
+
+#include "spin.h"
+#include "spin_parse.h"
+#include "spin_atom.h"
+
+/* owned by the parser while a list streams in */
+typedef struct
+{
+  gboolean ignored;
+  gint chat;
+  GString* text;
+} SpinList;
+
+/* strings are borrowed from the line being handled, raw_room is kept as
+   received for replies */
+typedef struct
+{
+  SpinEventType type;
+  gchar kind;
+  PurpleConvChatBuddyFlags flags;
+  const gchar* room;
+  const gchar* raw_room;
+  const gchar* user;
+  const gchar* other;
+  const gchar* text;
+  const gchar* extra;
+  const gchar* id;
+  const gchar* password;
+  const SpinAtom* room_atom;
+  const SpinAtom* user_atom;
+  gint status;
+  SpinSpan* body; /* decoded only once the room is known */
+  SpinVerbStats* null_stats;
+  SpinList* list;
+} SpinEvent;
+
+void spin_event_apply(SpinData* spin,SpinEvent* ev);
+void spin_event_log_stats(SpinData* spin);
+
+#endif
@@ -0,0 +1,245 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "spin_framer.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define SPIN_SCAN_X86 1
+#  include <immintrin.h>
+#endif
+
+/* offset of the first '\n' or len, NULs before it become spaces */
+typedef gsize (*SpinScanFunc)(gchar* p,gsize len);
+
+static SpinScanFunc spin_scan;
+
+static gsize spin_scan_scalar(gchar* p,gsize len)
+{
+  gsize i;
+  for(i = 0; i < len; ++i)
+    {
+      if(p[i] == '\n')
+	return i;
+      if(p[i] == '\0')
+	p[i] = ' ';
+    }
+  return len;
+}
+
+#if SPIN_SCAN_X86
+
+static inline void spin_scan_fix_nuls(gchar* p,guint32 nuls)
+{
+  while(nuls)
+    {
+      p[__builtin_ctz(nuls)] = ' ';
+      nuls &= nuls - 1;
+    }
+}
+
+__attribute__((target("sse2")))
+static gsize spin_scan_sse2(gchar* p,gsize len)
+{
+  const __m128i nl = _mm_set1_epi8('\n'),zero = _mm_setzero_si128(),
+    space = _mm_set1_epi8(' ');
+  gsize i;
+
+  for(i = 0; i + 16 <= len; i += 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+      __m128i is_nul = _mm_cmpeq_epi8(v,zero);
+      guint32 nls = _mm_movemask_epi8(_mm_cmpeq_epi8(v,nl));
+      guint32 nuls = _mm_movemask_epi8(is_nul);
+
+      if(nls)
+	{
+	  guint32 first = __builtin_ctz(nls);
+	  spin_scan_fix_nuls(p + i,nuls & ((1u << first) - 1));
+	  return i + first;
+	}
+      if(nuls)
+	_mm_storeu_si128((__m128i*) (p + i),
+			 _mm_or_si128(_mm_and_si128(is_nul,space),
+				      _mm_andnot_si128(is_nul,v)));
+    }
+
+  return i + spin_scan_scalar(p + i,len - i);
+}
+
+__attribute__((target("avx2")))
+static gsize spin_scan_avx2(gchar* p,gsize len)
+{
+  const __m256i nl = _mm256_set1_epi8('\n'),zero = _mm256_setzero_si256(),
+    space = _mm256_set1_epi8(' ');
+  gsize i;
+
+  for(i = 0; i + 32 <= len; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i*) (p + i));
+      __m256i is_nul = _mm256_cmpeq_epi8(v,zero);
+      guint32 nls = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v,nl));
+      guint32 nuls = _mm256_movemask_epi8(is_nul);
+
+      if(nls)
+	{
+	  guint32 first = __builtin_ctz(nls);
+	  spin_scan_fix_nuls(p + i,nuls & ((1u << first) - 1));
+	  return i + first;
+	}
+      if(nuls)
+	_mm256_storeu_si256((__m256i*) (p + i),
+			    _mm256_blendv_epi8(v,space,is_nul));
+    }
+
+  return i + spin_scan_sse2(p + i,len - i);
+}
+
+#endif
+
+static void spin_scan_select(void)
+{
+  spin_scan = spin_scan_scalar;
+#if SPIN_SCAN_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    spin_scan = spin_scan_avx2;
+  else if(__builtin_cpu_supports("sse2"))
+    spin_scan = spin_scan_sse2;
+#endif
+}
+
+SpinFramer* spin_framer_new(gsize min_size)
+{
+  if(!spin_scan)
+    spin_scan_select();
+
+  SpinFramer* framer = g_new0(SpinFramer,1);
+  framer->min_size = framer->size = min_size;
+  framer->data = g_malloc(min_size);
+  return framer;
+}
+
+void spin_framer_free(SpinFramer* framer)
+{
+  if(!framer)
+    return;
+  g_free(framer->data);
+  g_free(framer);
+}
+
+static void spin_framer_compact(SpinFramer* framer)
+{
+  if(!framer->start)
+    return;
+  memmove(framer->data,framer->data + framer->start,
+	  framer->end - framer->start);
+  framer->scan -= framer->start;
+  framer->end -= framer->start;
+  framer->start = 0;
+}
+
+gchar* spin_framer_reserve(SpinFramer* framer,gsize len)
+{
+  g_return_val_if_fail(framer,NULL);
+
+  if(framer->size - framer->end >= len)
+    return framer->data + framer->end;
+
+  if(framer->size - (framer->end - framer->start) >= len)
+    {
+      spin_framer_compact(framer);
+      return framer->data + framer->end;
+    }
+
+  spin_framer_compact(framer);
+  gsize size = framer->size;
+  while(size - framer->end < len)
+    size *= 2;
+  framer->data = g_realloc(framer->data,size);
+  framer->size = size;
+  return framer->data + framer->end;
+}
+
+void spin_framer_commit(SpinFramer* framer,gsize len)
+{
+  g_return_if_fail(framer);
+  g_return_if_fail(framer->size - framer->end >= len);
+  framer->end += len;
+}
+
+gchar* spin_framer_next_line(SpinFramer* framer)
+{
+  g_return_val_if_fail(framer,NULL);
+
+  gsize len = framer->end - framer->scan;
+  gsize off = spin_scan(framer->data + framer->scan,len);
+  if(off == len)
+    {
+      framer->scan = framer->end;
+      return NULL;
+    }
+
+  gchar* line = framer->data + framer->start;
+  framer->data[framer->scan + off] = '\0';
+  framer->start = framer->scan = framer->scan + off + 1;
+  return line;
+}
+
+gchar* spin_framer_partial(SpinFramer* framer,gsize* len)
+{
+  g_return_val_if_fail(framer,NULL);
+  g_return_val_if_fail(len,NULL);
+
+  *len = framer->scan - framer->start;
+  return framer->data + framer->start;
+}
+
+void spin_framer_consume(SpinFramer* framer,gsize len)
+{
+  g_return_if_fail(framer);
+  g_return_if_fail(framer->scan - framer->start >= len);
+  framer->start += len;
+}
+
+gsize spin_framer_pending(const SpinFramer* framer)
+{
+  g_return_val_if_fail(framer,0);
+  return framer->end - framer->start;
+}
+
+void spin_framer_settle(SpinFramer* framer,gsize keep)
+{
+  g_return_if_fail(framer);
+
+  if(framer->start == framer->end)
+    framer->start = framer->scan = framer->end = 0;
+
+  /* give back the memory of a huge line */
+  gsize pending = framer->end - framer->start;
+  keep = MAX(keep,framer->min_size);
+  if(framer->size / 2 >= keep && pending < framer->size / 4)
+    {
+      gsize size = framer->size;
+      while(size / 2 >= keep && pending < size / 4)
+	size /= 2;
+      spin_framer_compact(framer);
+      framer->data = g_realloc(framer->data,size);
+      framer->size = size;
+    }
+}
@@ -0,0 +1,47 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef SPIN_FRAMER_H_
+#define SPIN_FRAMER_H_
+
+#include <glib.h>
+
+/* data[start,scan) is scanned, data[scan,end) not yet */
+typedef struct
+{
+  gchar* data;
+  gsize size,min_size;
+  gsize start,scan,end;
+} SpinFramer;
+
+SpinFramer* spin_framer_new(gsize min_size);
+void spin_framer_free(SpinFramer* framer);
+
+gchar* spin_framer_reserve(SpinFramer* framer,gsize len);
+void spin_framer_commit(SpinFramer* framer,gsize len);
+
+/* valid until the next reserve or settle */
+gchar* spin_framer_next_line(SpinFramer* framer);
+
+gchar* spin_framer_partial(SpinFramer* framer,gsize* len);
+void spin_framer_consume(SpinFramer* framer,gsize len);
+
+gsize spin_framer_pending(const SpinFramer* framer);
+
+void spin_framer_settle(SpinFramer* framer,gsize keep);
+
+#endif
@@ -0,0 +1,237 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+#include "spin_highlight.h"
+#include "spin_text.h"
+
+#include <string.h>
+
+/* Aho-Corasick with the failure links resolved into the table. Bytes not
+   in any word share class 0, upper case ASCII shares the lower case one. */
+typedef struct
+{
+  gint out;         /* nearest node on the failure path ending a word, or -1 */
+  guint len;        /* length of the word ending here, 0 for none */
+  gboolean head_word,tail_word; /* whether its first/last byte is a word
+				   character */
+} SpinHighlightNode;
+
+struct _SpinHighlight
+{
+  GPtrArray* words; /* casefolded, until compiled */
+  gboolean unicode; /* some word is not ASCII, so texts need casefolding */
+  guint8 classes[256];
+  guint n_classes;
+  GArray* nodes;    /* SpinHighlightNode */
+  gint* next;       /* nodes->len * n_classes */
+};
+
+/* like \w, all non-ASCII bytes count as letters */
+static inline gboolean spin_highlight_is_word(guchar c)
+{
+  return c >= 0x80 || g_ascii_isalnum(c) || c == '_';
+}
+
+SpinHighlight* spin_highlight_new(void)
+{
+  SpinHighlight* h = g_new0(SpinHighlight,1);
+  h->words = g_ptr_array_new_with_free_func(g_free);
+  return h;
+}
+
+void spin_highlight_free(SpinHighlight* h)
+{
+  if(!h)
+    return;
+  if(h->words)
+    g_ptr_array_free(h->words,TRUE);
+  if(h->nodes)
+    g_array_free(h->nodes,TRUE);
+  g_free(h->next);
+  g_free(h);
+}
+
+void spin_highlight_add(SpinHighlight* h,const gchar* word,gboolean plural)
+{
+  g_return_if_fail(h->words);
+
+  if(!*word || !g_utf8_validate(word,-1,NULL))
+    return;
+
+  gchar* folded = g_utf8_casefold(word,-1);
+  gsize len = strlen(folded);
+  if(spin_text_ascii_prefix(folded,len) != len)
+    h->unicode = TRUE;
+  g_ptr_array_add(h->words,folded);
+  if(plural)
+    g_ptr_array_add(h->words,g_strconcat(folded,"s",NULL));
+}
+
+void spin_highlight_add_list(SpinHighlight* h,const gchar* list)
+{
+  gchar** words = g_strsplit(list,",",-1);
+  gchar** i;
+
+  for(i = words; *i; ++i)
+    spin_highlight_add(h,g_strstrip(*i),FALSE);
+  g_strfreev(words);
+}
+
+static gint spin_highlight_node_new(SpinHighlight* h)
+{
+  SpinHighlightNode node = {-1,0,FALSE,FALSE};
+  g_array_append_val(h->nodes,node);
+  return h->nodes->len - 1;
+}
+
+void spin_highlight_compile(SpinHighlight* h)
+{
+  guint i,c;
+  gsize states = 1;
+  gchar* w;
+
+  g_return_if_fail(h->words);
+
+  /* byte classes, and an upper bound of the number of nodes */
+  memset(h->classes,0,sizeof(h->classes));
+  h->n_classes = 1;
+  for(i = 0; i < h->words->len; ++i)
+    for(w = g_ptr_array_index(h->words,i); *w; ++w, ++states)
+      if(!h->classes[(guchar) *w])
+	h->classes[(guchar) *w] = h->n_classes++;
+  for(c = 'A'; c <= 'Z'; ++c)
+    h->classes[c] = h->classes[(guchar) g_ascii_tolower(c)];
+
+  h->nodes = g_array_sized_new(FALSE,FALSE,sizeof(SpinHighlightNode),states);
+  h->next = g_new(gint,states * h->n_classes);
+  memset(h->next,0xff,states * h->n_classes * sizeof(gint));
+  spin_highlight_node_new(h);
+
+  /* the trie */
+  for(i = 0; i < h->words->len; ++i)
+    {
+      const guchar* word = g_ptr_array_index(h->words,i);
+      const guchar* p;
+      gint cur = 0;
+      for(p = word; *p; ++p)
+	{
+	  gint* next = &h->next[cur * h->n_classes + h->classes[*p]];
+	  if(*next < 0)
+	    *next = spin_highlight_node_new(h);
+	  cur = *next;
+	}
+      SpinHighlightNode* node = &g_array_index(h->nodes,SpinHighlightNode,cur);
+      node->len = p - word;
+      node->head_word = spin_highlight_is_word(word[0]);
+      node->tail_word = spin_highlight_is_word(p[-1]);
+    }
+
+  /* failure links in breadth first order, folded into the transitions */
+  gint* fail = g_new0(gint,h->nodes->len);
+  gint* queue = g_new(gint,h->nodes->len);
+  guint head = 0,tail = 0;
+  for(c = 0; c < h->n_classes; ++c)
+    {
+      gint* next = &h->next[c];
+      if(*next < 0)
+	*next = 0;
+      else
+	queue[tail++] = *next;
+    }
+  while(head < tail)
+    {
+      gint u = queue[head++];
+      for(c = 0; c < h->n_classes; ++c)
+	{
+	  gint* next = &h->next[u * h->n_classes + c];
+	  gint f = h->next[fail[u] * h->n_classes + c];
+	  if(*next < 0)
+	    {
+	      *next = f;
+	      continue;
+	    }
+	  fail[*next] = f;
+	  SpinHighlightNode* fnode = &g_array_index(h->nodes,SpinHighlightNode,f);
+	  g_array_index(h->nodes,SpinHighlightNode,*next).out =
+	    fnode->len ? f : fnode->out;
+	  queue[tail++] = *next;
+	}
+    }
+  g_free(queue);
+  g_free(fail);
+
+  g_ptr_array_free(h->words,TRUE);
+  h->words = NULL;
+}
+
+/* whether one of the words ending at text[end] stands on its own */
+static gboolean spin_highlight_check(const SpinHighlight* h,gint state,
+				     const guchar* text,gsize end)
+{
+  for(; state >= 0;
+      state = g_array_index(h->nodes,SpinHighlightNode,state).out)
+    {
+      const SpinHighlightNode* node =
+	&g_array_index(h->nodes,SpinHighlightNode,state);
+      gsize start = end + 1 - node->len;
+      if(!node->len)
+	continue;
+      if(node->head_word && start > 0
+	 && spin_highlight_is_word(text[start - 1]))
+	continue;
+      if(node->tail_word && spin_highlight_is_word(text[end + 1]))
+	continue;
+      return TRUE;
+    }
+  return FALSE;
+}
+
+static gboolean spin_highlight_scan(const SpinHighlight* h,
+				    const guchar* text)
+{
+  gint state = 0;
+  gsize i;
+
+  for(i = 0; text[i]; ++i)
+    {
+      state = h->next[state * h->n_classes + h->classes[text[i]]];
+      if(state && spin_highlight_check(h,state,text,i))
+	return TRUE;
+    }
+  return FALSE;
+}
+
+gboolean spin_highlight_match(const SpinHighlight* h,const gchar* text)
+{
+  gboolean found;
+  gchar* folded;
+  gsize len;
+
+  g_return_val_if_fail(h->nodes,FALSE);
+
+  if(h->nodes->len <= 1)
+    return FALSE;
+
+  /* non-ASCII letters can only match after folding the whole text */
+  if(!h->unicode
+     || spin_text_ascii_prefix(text,(len = strlen(text))) == len)
+    return spin_highlight_scan(h,(const guchar*) text);
+
+  folded = g_utf8_casefold(text,-1);
+  found = spin_highlight_scan(h,(const guchar*) folded);
+  g_free(folded);
+  return found;
+}
@@ -0,0 +1,42 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef SPIN_HIGHLIGHT_H_
+#define SPIN_HIGHLIGHT_H_
+
+#include <glib.h>
+
+/* finds any of a list of words in a message in one pass, ignoring case.
+   Words only match on their own: a match must not be preceded or followed
+   by a letter, digit or '_' where the word itself begins or ends with
+   one. Built once per session, see spin_highlight_compile. */
+typedef struct _SpinHighlight SpinHighlight;
+
+SpinHighlight* spin_highlight_new(void);
+void spin_highlight_free(SpinHighlight* h);
+
+/* adds a UTF-8 word, with plural also matching word + "s". Only valid
+   before spin_highlight_compile */
+void spin_highlight_add(SpinHighlight* h,const gchar* word,gboolean plural);
+/* adds the comma separated words of list */
+void spin_highlight_add_list(SpinHighlight* h,const gchar* list);
+/* builds the matcher from the words added so far */
+void spin_highlight_compile(SpinHighlight* h);
+
+/* whether one of the words occurs in the UTF-8 text */
+gboolean spin_highlight_match(const SpinHighlight* h,const gchar* text);
+
+#endif
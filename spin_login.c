@@ -17,6 +17,13 @@
 
 #include "spin_login.h"
 #include "spin_web.h"
+#include "spin_parse.h"
+#include "spin_proto.h"
+#include "spin_chat.h"
+#include "spin_event.h"
+#include "spin_atom.h"
+#include "spin_highlight.h"
+#include "spin_uring.h"
 #include "debug.h"
 #include <unistd.h>
 #ifdef WIN32
@@ -52,9 +59,9 @@ static void connect_cb(void* data,gint source,const char* errmsg)
 
   spin_start_read(spin);
 
-  spin_write_command(spin,'A',"prpl-spin",NULL);
-  spin_write_command(spin,'B',"I'm a bot.",NULL);
-  spin_write_command(spin,'a',spin->username,spin->session,NULL);
+  spin_send_client(spin,"prpl-spin");
+  spin_send_agent(spin,"I'm a bot.");
+  spin_send_login(spin,spin->username,spin->session);
 }
 
 static void spin_do_chat_login(SpinData* spin)
@@ -143,16 +150,23 @@ static void spin_weblogin_cb(PurpleUtilFetchUrlData* url_data,gpointer userp,
       return;
     }
   spin->username = json_node_dup_string(login);
-  spin->normalized_username =
-    g_strdup(purple_normalize(account,json_node_get_string(login)));
+  if(!(spin->self = spin_atom_utf8(spin,spin->username)))
+    {
+      purple_connection_error_reason
+	(gc,PURPLE_CONNECTION_ERROR_INVALID_USERNAME,
+	 _("username contains characters the chat server does not support"));
+      return;
+    }
   purple_connection_set_display_name(gc, spin->username);
 
-  gchar* escaped_username = g_regex_escape_string(spin->username,-1);
-  gchar* nick_regex_str = g_strdup_printf("(?i)\\b%ss?\\b",escaped_username);
-  spin->nick_regex = g_regex_new(nick_regex_str,G_REGEX_OPTIMIZE,0,NULL);
-  g_assert(spin->nick_regex);
-  g_free(escaped_username);
-  g_free(nick_regex_str);
+  /* a configured nick regex replaces matching the nick */
+  spin->highlight = spin_highlight_new();
+  if(!spin->nick_regex)
+    spin_highlight_add(spin->highlight,spin->username,TRUE);
+  spin_highlight_add_list(spin->highlight,
+			  purple_account_get_string(account,"highlight-words",
+						    ""));
+  spin_highlight_compile(spin->highlight);
 
   spin_connect_add_state(spin,SPIN_STATE_GOT_WEB_LOGIN);
 
@@ -217,15 +231,29 @@ void spin_login(PurpleAccount* a)
   SpinData* spin;
   gc->proto_data = spin = g_new0(SpinData,1);
   spin->gc = gc;
-  spin->inbuf = g_string_new("");
-  spin->outbuf = purple_circ_buffer_new(0);
+  spin->epoll_fd = -1;
+  spin->inbuf = spin_framer_new(2 * SPIN_READ_CHUNK_MIN);
+  spin->read_chunk = SPIN_READ_CHUNK_MIN;
+  gint max_line_buffer = purple_account_get_int(a,"max-line-buffer",
+						SPIN_MAX_LINE_BUFFER);
+  if(max_line_buffer <= 0)
+    max_line_buffer = SPIN_MAX_LINE_BUFFER;
+  spin->max_inbuf = MAX((gsize) max_line_buffer * 1024,SPIN_READ_CHUNK_MAX);
   spin->session = NULL;
   spin->state = 0;
   spin->nick_regex = nick_regex;
+  spin->profile = purple_account_get_bool(a,"profile",FALSE);
   spin->pending_joins = g_hash_table_new_full(g_str_hash,g_str_equal,
 					      g_free,NULL);
   spin->updated_status_list = g_hash_table_new_full(g_str_hash,g_str_equal,
 						    g_free,NULL);
+  spin->member_updates = g_hash_table_new_full(g_direct_hash,g_direct_equal,
+					       NULL,
+					       spin_chat_member_updates_free);
+  spin->deferred_rooms = g_hash_table_new_full(g_str_hash,g_str_equal,
+					       g_free,NULL);
+  spin->render = g_string_sized_new(256);
+  spin_atoms_init(spin);
 
   purple_connection_set_state(gc, PURPLE_CONNECTING);
   purple_connection_update_progress(gc,Q_("Progress|Web login"),1,4);
@@ -265,14 +293,23 @@ void spin_close(PurpleConnection* gc)
 
   if(spin->ping_timeout_handle)
     purple_timeout_remove(spin->ping_timeout_handle);
+#if SPIN_USE_IO_URING
+  spin_uring_stop(spin);
+#endif
+  if(spin->deferred_handle)
+    purple_timeout_remove(spin->deferred_handle);
   if(spin->read_handle)
     purple_input_remove(spin->read_handle);
   if(spin->write_handle)
     purple_input_remove(spin->write_handle);
+  spin_parse_log_stats(spin);
+  spin_event_log_stats(spin);
+  spin_parse_reset(spin);
+  if(spin->epoll_fd >= 0)
+    close(spin->epoll_fd);
   if(spin->inbuf)
-    g_string_free(spin->inbuf,TRUE);
-  if(spin->outbuf)
-    purple_circ_buffer_destroy(spin->outbuf);
+    spin_framer_free(spin->inbuf);
+  g_free(spin->outbuf.data);
   if(spin->fd)
     {
       send(spin->fd,"e\n",2, 0 
@@ -291,12 +328,18 @@ void spin_close(PurpleConnection* gc)
     g_hash_table_destroy(spin->pending_joins);
   if(spin->updated_status_list)
     g_hash_table_destroy(spin->updated_status_list);
+  if(spin->member_updates)
+    g_hash_table_destroy(spin->member_updates);
+  if(spin->deferred_rooms)
+    g_hash_table_destroy(spin->deferred_rooms);
+  if(spin->render)
+    g_string_free(spin->render,TRUE);
   if(spin->username)
     g_free(spin->username);
-  if(spin->normalized_username)
-    g_free(spin->normalized_username);
+  spin_atoms_free(spin);
   if(spin->nick_regex)
     g_regex_unref(spin->nick_regex);
+  spin_highlight_free(spin->highlight);
 
   g_free(spin);
   gc->proto_data = NULL;
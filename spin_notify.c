@@ -85,13 +85,13 @@ void spin_notify_game_invite(SpinData* spin,const gchar* nick,
 		      _("%s has invited you to a game %s"),nick,title);
 }
 
-void spin_notify_guestbook_entry(SpinData* spin,gchar* who)
+void spin_notify_guestbook_entry(SpinData* spin,const gchar* who)
 {
   spin_notify_message(spin,_("New guestbook entry!"),
 		      _("%s has added a new entry to your guestbook"),who);
 }
 
-void spin_notify_gift(SpinData* spin,gchar* who)
+void spin_notify_gift(SpinData* spin,const gchar* who)
 {
   spin_notify_message(spin,_("New gift!"),_("%s has given you something"),
 		      who);
@@ -26,6 +26,6 @@ void spin_notify_nick_removed(SpinData* spin,const gchar* nick);
 void spin_notify_game_invite(SpinData* spin,const gchar* nick,
 			     const gchar* title,const gchar* t,
 			     const gchar* id,const gchar* passwd);
-void spin_notify_guestbook_entry(SpinData* spin,gchar* who);
-void spin_notify_gift(SpinData* spin,gchar* who);
+void spin_notify_guestbook_entry(SpinData* spin,const gchar* who);
+void spin_notify_gift(SpinData* spin,const gchar* who);
 #endif
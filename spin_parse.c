@@ -16,114 +16,137 @@
 /* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "spin_parse.h"
-#include "spin_friends.h"
+#include "spin_event.h"
+#include "spin_proto.h"
+#include "spin_text.h"
+#include "spin_atom.h"
 
 #include "debug.h"
 #include "connection.h"
-#include "server.h"
-#include "spin_notify.h"
-#include "spin_mail.h"
 #include "spin_chat.h"
-/* #include "spin_privacy.h" */
-#include "spin_prefs.h"
-#include "spin_login.h"
 
 #include <string.h>
 
-static const gchar* leave_reasons[] =
-  {
-    N_("left the room"),
-    N_("kicked by %3$s%1$.0s%2$.0s"),
-    N_("kicked by the server"),
-    N_("you are banned"),
-    N_("room %2$s is currently full%1$.0s"),
-    N_("room %2$s is closed%1$.0s"),
-    N_("creation of new rooms is not allowed"),
-    N_("room is for registered users only"),
-    N_("room is for VIP users only"),
-    N_("room could not be created: too many rooms"),
-    N_("room could not be created: room name is illegal"),
-    N_("too long inactive"),
-    N_("kicked of the server")
-  };
-
-static gchar* simple_strsep(gchar** in,gchar c)
+/* splits line at sep into at most max fields in one pass, the last field
+   keeps the rest of the line. The fields are NUL terminated in place,
+   missing ones are set to NULL. Returns the number of fields found. */
+static guint spin_split(gchar* line,gchar sep,SpinSpan* f,guint max)
 {
-  if(!in || !*in)
-    return NULL;
+  guint n = 0,i;
+  gchar* p = line;
 
-  gchar* p = strchr(*in,c),*q=*in;
-  if(p)
+  while(p && n < max)
     {
-      *p = '\0';
-      *in = p+1;
-      return q;
+      f[n].str = p;
+      f[n].utf8 = NULL;
+      f[n].atom = NULL;
+      if(n + 1 < max)
+	while(*p && *p != sep)
+	  ++p;
+      else
+	while(*p)
+	  ++p;
+      f[n].len = p - f[n].str;
+      ++n;
+
+      if(*p)
+	*p++ = '\0';
+      else
+	p = NULL;
     }
-  else
+
+  for(i = n; i < max; ++i)
     {
-      *in = NULL;
-      return q;
+      f[i].str = NULL;
+      f[i].len = 0;
+      f[i].utf8 = NULL;
+      f[i].atom = NULL;
     }
+  return n;
 }
 
-static G_GNUC_NULL_TERMINATED void spin_split_line(gchar* line,...) 
+SpinAtom* spin_field_atom(SpinData* spin,SpinSpan* f)
 {
-  va_list ap;
-  gchar **p,**q = NULL;
-  va_start(ap,line);
-  while((p = va_arg(ap,gchar**)))
-    {
-      if(q)
-	*q = simple_strsep(&line,'#');
-      q = p;
-      *p = line;
-    }
-  va_end(ap);
+  if(!f->atom && f->str)
+    f->atom = spin_atom_raw(spin,f->str,f->len);
+  return f->atom;
 }
 
-static gchar* spin_convert_user(SpinData* spin,gchar* user)
+gchar* spin_field_user(SpinData* spin,SpinSpan* f)
 {
-  g_return_val_if_fail(user,NULL);
-  
-  gsize bytes_in,bytes_out,len = strlen(user);
-  GError* error = NULL;
-  gchar* out = g_convert(user,len,"UTF-8","ISO-8859-15",&bytes_in,&bytes_out,
-			 &error);
-  if(error || bytes_in != len)
+  SpinAtom* atom = spin_field_atom(spin,f);
+  return atom ? atom->utf8 : NULL;
+}
+
+gchar* spin_field_text(SpinData* spin,SpinSpan* f)
+{
+  gsize need;
+
+  if(f->utf8 || !f->str)
+    return f->utf8;
+
+  need = SPIN_TEXT_IN_MAX(f->len);
+  if(spin->text_used + need <= spin->text_size)
     {
-      if(out)
-	g_free(out);
-      purple_connection_error_reason
-	(spin->gc,PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
-	 _("invalid coded room name received"));
-      
-      return NULL;
+      f->utf8 = spin->text_buf + spin->text_used;
+      spin->text_used += spin_text_in_utf8(f->str,f->len,f->utf8) + 1;
+    }
+  else
+    {
+      /* the buffer grows before the next line */
+      f->utf8 = g_malloc(need);
+      spin_text_in_utf8(f->str,f->len,f->utf8);
+      spin->text_want = MIN(MAX(spin->text_want,spin->text_used + need),
+			    SPIN_TEXT_BUF_MAX);
     }
-  return out;
+  return f->utf8;
 }
 
-gchar* spin_write_chat(gchar ty,const gchar* user,const gchar* t)
+static void spin_field_release(SpinData* spin,SpinSpan* f)
 {
-  static GRegex* me_re;
-  if(!me_re) /* RACE CONDITION */
-    me_re = g_regex_new("[/.]me",G_REGEX_OPTIMIZE,0,NULL);
+  if(f->utf8 < spin->text_buf || f->utf8 >= spin->text_buf + spin->text_size)
+    g_free(f->utf8);
+  f->utf8 = NULL;
+}
 
-  gchar *text,*text2;
+/* the first "/me" or ".me" in t */
+static const gchar* spin_find_me(const gchar* t)
+{
+  for(; (t = strpbrk(t,"/.")); ++t)
+    if(t[1] == 'm' && t[2] == 'e')
+      return t;
+  return NULL;
+}
+
+const gchar* spin_write_chat(GString* out,gchar ty,const gchar* user,
+			     const gchar* t)
+{
+  const gchar* me;
+
+  g_string_truncate(out,0);
   switch(ty)
     {
     case 'c':
     case 'd':
-      /* text = g_strconcat("/me ",t,NULL); */
-      return g_markup_printf_escaped("/me %s",t);
+      g_string_append_len(out,"/me ",4);
+      spin_text_escape(out,t,-1);
+      break;
     case 'e':
     case 'f':
-      text =  g_regex_replace_literal(me_re,t,-1,0,user,0,NULL);
-      text2 = g_markup_printf_escaped("/me %s <i>[echo]</i>",text);
-      g_free(text);
-      return text2;
+      /* echoes have the user in place of every /me */
+      g_string_append_len(out,"/me ",4);
+      for(; (me = spin_find_me(t)); t = me + 3)
+	{
+	  spin_text_escape(out,t,me - t);
+	  spin_text_escape(out,user,-1);
+	}
+      spin_text_escape(out,t,-1);
+      g_string_append(out," <i>[echo]</i>");
+      break;
     default:
-      return g_markup_escape_text(t,-1);
+      spin_text_escape(out,t,-1);
     }
+  return out->str;
 }
 
 PurpleConvChatBuddyFlags spin_get_flags(const gchar* r)
@@ -149,760 +172,806 @@ PurpleConvChatBuddyFlags spin_get_flags(const gchar* r)
   return flags;
 }
 
-static void spin_chat_notfound(SpinData* spin,const gchar* room,const gchar* raw_room)
+/* '0'-type sub-commands, hashed by (first letter ^ length) % 8 which has
+   no collisions for this set */
+static const struct
 {
-  purple_debug_info("spin","room not found: %s\n",room);
-  /* try to leave the room */
-  spin_write_command(spin,'d',raw_room,NULL);
-}
+  const gchar* name;
+  SpinNullCommand cmd;
+} spin_null_commands[SPIN_NULL_SLOTS] =
+  {
+    [0] = {"nospam",SPIN_NULL_NOSPAM},
+    [3] = {"warn",SPIN_NULL_WARN},
+    [4] = {"ping",SPIN_NULL_PING},
+    [5] = {"away",SPIN_NULL_AWAY},
+    [7] = {"invite",SPIN_NULL_INVITE},
+  };
 
-static void spin_handle_connected(SpinData* spin,gchar* rest)
+static SpinNullCommand spin_null_command(SpinData* spin,const SpinSpan* ty,
+					  SpinEvent* ev)
 {
-  PurpleAccount* account = purple_connection_get_account(spin->gc);
-  purple_debug_info("spin","connected\n");
-  spin_connect_add_state(spin,SPIN_STATE_GOT_CHAT_LOGIN);
+  guint slot;
+
+  if(!ty->len)
+    return SPIN_NULL_COUNT;
+  slot = (g_ascii_tolower(ty->str[0]) ^ ty->len) % SPIN_NULL_SLOTS;
+  if(!spin_null_commands[slot].name
+     || g_ascii_strcasecmp(spin_null_commands[slot].name,ty->str) != 0)
+    return SPIN_NULL_COUNT;
+  ev->null_stats = &spin->null_stats[slot];
+  return spin_null_commands[slot].cmd;
+}
 
-  spin_set_status(account,purple_account_get_active_status(account));
+/* the decoders turn the fields of a line into an event, sub is scratch
+   space for splitting the last field further. They return FALSE if the
+   line has no effect. */
 
-  purple_connection_update_progress(spin->gc,Q_("Progress|Receiving Prefs"),
-				    1,4);
-  spin_receive_friends(spin);
-  spin_check_mail(spin);
-  /*spin_sync_privacy_lists(spin);*/
-  spin_load_prefs(spin);
+static gboolean spin_decode_connected(SpinData* spin,SpinSpan* f,
+				      SpinSpan* sub,SpinEvent* ev)
+{
+  ev->type = SPIN_EVENT_CONNECTED;
+  return TRUE;
 }
 
-static void spin_handle_disconnected(SpinData* spin,gchar* rest)
+static gboolean spin_decode_disconnected(SpinData* spin,SpinSpan* f,
+					 SpinSpan* sub,SpinEvent* ev)
 {
-  purple_debug_info("spin","disconnected\n");
-  if(purple_connection_get_state(spin->gc) == PURPLE_CONNECTING)
-    purple_connection_error_reason
-      (spin->gc,PURPLE_CONNECTION_ERROR_AUTHENTICATION_FAILED,
-       _("chat server denied login"));
-  else
-    ; //purple_connection_set_state(spin->gc,PURPLE_DISCONNECTED);
+  ev->type = SPIN_EVENT_DISCONNECTED;
+  return TRUE;
 }
 
-static void spin_handle_null_msg(SpinData* spin,gchar* user,gchar* r,gchar* t)
+/* <command>#<args> of a private '0'-type message, already UTF-8 */
+static gboolean spin_decode_null_msg(SpinData* spin,gchar* t,SpinSpan* sub,
+				     SpinEvent* ev)
 {
-  PurpleAccount* account = purple_connection_get_account(spin->gc);
-  gchar *ty,*args,*escaped_args = NULL;
-  spin_split_line(t,&ty,&args,NULL); /* args already utf8,ensured by caller */
-  
-  if(g_ascii_strcasecmp(ty,"away") == 0)
-    {
-      PurpleConversation* conv =
-	purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM,user,account);
-      if(!conv)
-	goto exit;
-      gboolean show = TRUE;
-      const gchar* setting = purple_account_get_string(account,"show-away",
-						       "always");
-      if(g_strcmp0(setting,"never") == 0)
-	show = FALSE;
-      else if(g_strcmp0(setting,"non-buddys") == 0)
-	{
-	  if(purple_find_buddy(account,user))
-	    show = FALSE;
-	}
+  spin_split(t,'#',sub,2);
+  ev->text = sub[1].str;
 
-      if(show)
-	{
-	  escaped_args = g_markup_escape_text(args,-1);
-	  purple_conv_im_write(PURPLE_CONV_IM(conv),user,escaped_args,
-			       PURPLE_MESSAGE_AUTO_RESP,time(NULL));
-	}
-    }
-  else if(g_ascii_strcasecmp(ty,"ping") == 0)
+  switch(spin_null_command(spin,&sub[0],ev))
     {
-      gchar* encoded_user = spin_encode_user(user);
-      if(!encoded_user)
-	goto exit;
-      spin_write_command(spin,'h',encoded_user,"2#0#pong",NULL);
-      g_free(encoded_user);
-    }
-  else if(g_ascii_strcasecmp(ty,"nospam") == 0)
-    {
-      purple_notify_warning(spin->gc,"spam warning",args ? args : "no spam!",
-			    user);
-    }
-  else if(g_ascii_strcasecmp(ty,"invite") == 0
-	  && g_str_has_prefix(args,"game#"))
-    {
-      gchar *what,*name,*id,*t,*passwd;
-      spin_split_line(args,&what,&name,&id,&t,&passwd,NULL);
-      spin_notify_game_invite(spin,user,name,t,id,passwd);
+    case SPIN_NULL_AWAY:
+      ev->type = SPIN_EVENT_AWAY_MSG;
+      return TRUE;
+    case SPIN_NULL_PING:
+      ev->type = SPIN_EVENT_PING_REQUEST;
+      return TRUE;
+    case SPIN_NULL_NOSPAM:
+      ev->type = SPIN_EVENT_NOSPAM;
+      return TRUE;
+    case SPIN_NULL_INVITE:
+      if(!g_str_has_prefix(sub[1].str,"game#"))
+	return FALSE;
+      /* game#name#id#type#password */
+      spin_split(sub[1].str,'#',sub,5);
+      ev->type = SPIN_EVENT_GAME_INVITE;
+      ev->text = sub[1].str;
+      ev->id = sub[2].str;
+      ev->extra = sub[3].str;
+      ev->password = sub[4].str;
+      return TRUE;
+    default:
+      return FALSE;
     }
+}
 
- exit:;
+/* h<user>#<echo>#<rank>#<type>#<text> */
+static gboolean spin_decode_private_msg(SpinData* spin,SpinSpan* f,
+					SpinSpan* sub,SpinEvent* ev)
+{
+  gchar* t;
+  if(f[1].str[0] != '0')
+    return FALSE;
+  if(!(ev->user = spin_field_user(spin,&f[0]))
+     || !(t = spin_field_text(spin,&f[4])))
+    return FALSE;
+
+  ev->kind = f[3].str[0];
+  if(ev->kind == '0')
+    return spin_decode_null_msg(spin,t,sub,ev);
+
+  ev->type = SPIN_EVENT_PRIVATE_MSG;
+  ev->text = t;
+  return TRUE;
 }
 
-static void spin_handle_private_msg(SpinData* spin,gchar* rest)
+static gboolean spin_decode_ping(SpinData* spin,SpinSpan* f,SpinSpan* sub,
+				 SpinEvent* ev)
 {
-  gchar *raw_user,*echo,*r,*ty,*raw_t,*t = NULL,*user=NULL,*written_t = NULL;
-  spin_split_line(rest,&raw_user,&echo,&r,&ty,&raw_t,NULL);
-  if(*echo != '0')
-    return;
-  if(!(user = spin_convert_user(spin,raw_user))
-     || !(t = spin_convert_in_text(raw_t)))
-    goto exit;
+  if(f[0].len != 1 || f[0].str[0] != 'p')
+    return FALSE;
+  ev->type = SPIN_EVENT_PONG;
+  return TRUE;
+}
+
+/* =<type>#<user>#<reason> */
+static gboolean spin_decode_status(SpinData* spin,SpinSpan* f,SpinSpan* sub,
+				   SpinEvent* ev)
+{
+  ev->kind = f[0].str[0];
+
+  /* the status list ('e') is ignored as we query over http *after*
+     login */
+  if(!f[1].str || (ev->kind != 'g' && ev->kind != 'h' && ev->kind != 'j'
+		   && ev->kind != 'i'))
+    return FALSE;
+
+  spin_split(f[1].str,'#',sub,2);
+  if(!(ev->user = spin_field_user(spin,&sub[0]))
+     || (sub[1].str && !(ev->text = spin_field_text(spin,&sub[1]))))
+    return FALSE;
+  ev->user_atom = sub[0].atom;
+
+  ev->type = SPIN_EVENT_STATUS;
+  return TRUE;
+}
 
-  if(*ty == '0')
+/* ><type>#<user>#<args> */
+static gboolean spin_decode_notify(SpinData* spin,SpinSpan* f,SpinSpan* sub,
+				   SpinEvent* ev)
+{
+  ev->type = SPIN_EVENT_NOTIFY;
+  ev->kind = f[0].str[0];
+
+  switch(ev->kind)
     {
-      spin_handle_null_msg(spin,user,r,t);
-      goto exit;
+    case 'l': /* reload friends */
+    case 'a': /* new mail */
+      return TRUE;
+    case 'b': /* new guestbook */
+    case 'c': /* new gift */
+      return (ev->user = spin_field_user(spin,&f[1])) != NULL;
+    default: /* 'i' room invited, 'j' chat with user invited */
+      return FALSE;
     }
+}
 
-  written_t = spin_write_chat(*ty,user,t);
+/* huge list lines ('j' chatter lists, 'l' room lists and 'n' ban lists)
+   are handled entry by entry while they arrive */
+#define SPIN_STREAM_MIN_LEN 1024
 
-  serv_got_im(spin->gc,user,written_t,0,time(NULL));
+struct _SpinStream
+{
+  gchar opcode;
+  gchar* raw_room;
+  gchar* room;
+  guint field;
+  SpinList list;
+};
+
+static void spin_stream_free(SpinStream* stream)
+{
+  if(stream->list.text)
+    g_string_free(stream->list.text,TRUE);
+  g_free(stream->raw_room);
+  g_free(stream->room);
+  g_free(stream);
+}
 
- exit:
-  g_free(written_t);
-  g_free(t);
-  g_free(user);
+static void spin_stream_event(SpinData* spin,SpinStream* stream,
+			      SpinEventType type,SpinEvent* ev)
+{
+  ev->type = type;
+  ev->kind = stream->opcode;
+  ev->room = stream->room;
+  ev->raw_room = stream->raw_room;
+  ev->list = &stream->list;
+  spin_event_apply(spin,ev);
 }
 
-static void spin_handle_ping(SpinData* spin,gchar* rest)
+static SpinStream* spin_stream_begin(SpinData* spin,gchar opcode,
+				     const SpinSpan* raw_room)
 {
-  if(g_strcmp0(rest,"p") != 0)
-    return;
-  if(spin->ping_timeout_handle)
+  SpinStream* stream = g_new0(SpinStream,1);
+  SpinEvent ev;
+
+  stream->opcode = opcode;
+  if(opcode != 'l')
     {
-      purple_timeout_remove(spin->ping_timeout_handle);
-      spin->ping_timeout_handle = 0;
+      /* every ISO-8859-15 byte has a character, only a missing room fails */
+      if(!raw_room->str)
+	{
+	  stream->list.ignored = TRUE;
+	  return stream;
+	}
+      stream->room = spin_latin9_to_utf8(raw_room->str,raw_room->len);
+      stream->raw_room = g_strndup(raw_room->str,raw_room->len);
     }
+
+  memset(&ev,0,sizeof(ev));
+  spin_stream_event(spin,stream,SPIN_EVENT_LIST_BEGIN,&ev);
+  return stream;
 }
 
-static void spin_handle_single_status(SpinData* spin,gchar ty,gchar* rest)
+static void spin_stream_entries(SpinData* spin,SpinStream* stream,
+				gchar* entries)
 {
-  gchar *raw_user,*raw_reason,*user=NULL,*reason=NULL;
-  PurpleAccount* account = purple_connection_get_account(spin->gc);
+  SpinSpan e[2],u[4];
+  SpinEvent ev;
+  gchar* text;
 
-  spin_split_line(rest,&raw_user,&raw_reason,NULL);
-  if(!(user = spin_convert_user(spin,raw_user))
-     || (raw_reason && !(reason = spin_convert_in_text(raw_reason))))
-    goto exit;
+  while(entries && !stream->list.ignored)
+    {
+      spin_split(entries,'#',e,2);
+      entries = e[1].str;
+      memset(&ev,0,sizeof(ev));
+      text = NULL;
 
-  PurpleBuddy *buddy = purple_find_buddy(account,user);
-  if(!buddy)
-    goto exit;
+      switch(stream->opcode)
+	{
+	case 'j':
+	  /* name:mode:state */
+	  if(spin_split(e[0].str,':',u,4) < 3
+	     || !(ev.user = spin_field_user(spin,&u[0])))
+	    continue;
+	  ev.user_atom = u[0].atom;
+	  ev.flags = spin_get_flags(u[1].str);
+#if SPIN_USE_CBFLAGS_AWAY
+	  if(memchr(u[2].str,'a',u[2].len))
+	    ev.flags |= PURPLE_CBFLAGS_AWAY;
+#endif
+	  break;
+	case 'l':
+	  ev.text = text = spin_latin9_to_utf8(e[0].str,e[0].len);
+	  break;
+	case 'n':
+	  /* ip#timecode#ip#timecode... */
+	  if(stream->field++ % 2 || !e[0].len)
+	    continue;
+	  ev.extra = text = spin_latin9_to_utf8(e[0].str,e[0].len);
+	  break;
+	}
 
-  if(ty == 'i')
-    {
-      purple_prpl_got_user_status(account,user,"away",
-				  "message",reason ? reason : "",NULL);
-    }
-  /* the javascript code treats away and online seperate, so receiving an
-     online message does not reset away state */
-  else if(ty == 'j'
-	  || (ty == 'g'
-	      && !purple_presence_is_online(purple_buddy_get_presence(buddy))))
-    {
-      purple_prpl_got_user_status(account,user,"available",NULL);
+      spin_stream_event(spin,stream,SPIN_EVENT_LIST_ENTRY,&ev);
+      g_free(text);
     }
-  else if(ty == 'h')
+}
+
+static void spin_stream_end(SpinData* spin,SpinStream* stream)
+{
+  SpinEvent ev;
+
+  if(stream->room || stream->opcode == 'l')
     {
-      purple_prpl_got_user_status(account,user,"offline",NULL);
+      memset(&ev,0,sizeof(ev));
+      spin_stream_event(spin,stream,SPIN_EVENT_LIST_END,&ev);
     }
+  spin_stream_free(stream);
+}
 
-  g_hash_table_insert(spin->updated_status_list,
-		      g_strdup(purple_normalize(account,user)),
-		      GINT_TO_POINTER(1));
+void spin_parse_reset(SpinData* spin)
+{
+  gchar* line;
 
- exit:
-  g_free(user);
-  g_free(reason);
+  if(spin->stream)
+    spin_stream_free(spin->stream);
+  spin->stream = NULL;
+
+  while((line = g_queue_pop_head(&spin->deferred)))
+    g_free(line);
+  if(spin->deferred_rooms)
+    g_hash_table_remove_all(spin->deferred_rooms);
+
+  spin->stream_usecs = 0;
+
+  g_free(spin->text_buf);
+  spin->text_buf = NULL;
+  spin->text_size = spin->text_used = spin->text_want = 0;
 }
 
-static void spin_handle_status_list(SpinData* spin,gchar* rest)
+/* the lists are applied as their own events, see spin_stream_begin */
+
+/* l<entries> */
+static gboolean spin_decode_list(SpinData* spin,SpinSpan* f,SpinSpan* sub,
+				 SpinEvent* ev)
 {
-  /* ignore this as we query over http *after* login */
+  SpinStream* stream = spin_stream_begin(spin,'l',NULL);
+  spin_stream_entries(spin,stream,f[0].str);
+  spin_stream_end(spin,stream);
+  return FALSE;
 }
 
-static void spin_handle_status(SpinData* spin,gchar* rest)
+/* j<room>#<entries> */
+static gboolean spin_decode_chatter_list(SpinData* spin,SpinSpan* f,
+					 SpinSpan* sub,SpinEvent* ev)
 {
-  gchar *ty,*raw_args;
-  spin_split_line(rest,&ty,&raw_args,NULL);
+  SpinStream* stream = spin_stream_begin(spin,'j',&f[0]);
+  if(f[1].str)
+    spin_stream_entries(spin,stream,f[1].str);
+  spin_stream_end(spin,stream);
+  return FALSE;
+}
 
-  if(!ty)
-    return;
+/* +<room>#<state>#<user>#<other user>#<rank>#<other>#<ip>#<msg> */
+static gboolean spin_decode_joinleave(SpinData* spin,SpinSpan* f,
+				      SpinSpan* sub,SpinEvent* ev)
+{
+  ev->raw_room = f[0].str;
+  ev->kind = f[1].str[0];
+  if(!(ev->room = spin_field_user(spin,&f[0]))
+     || !(ev->user = spin_field_user(spin,&f[2])))
+    return FALSE;
+  ev->room_atom = f[0].atom;
+  ev->user_atom = f[2].atom;
+
+  if(g_ascii_islower(ev->kind))
+    {
+      ev->type = SPIN_EVENT_JOIN;
+      ev->flags = f[4].str ? spin_get_flags(f[4].str) : PURPLE_CBFLAGS_NONE;
+      return TRUE;
+    }
 
-  if(*ty == 'g' || *ty == 'h' || *ty == 'j' || *ty == 'i')
-    spin_handle_single_status(spin,*ty,raw_args);
-  else if(*ty == 'e')
-    spin_handle_status_list(spin,raw_args);
+  /* the other user is only needed for the reason of a leave */
+  if(!(ev->other = spin_field_user(spin,&f[3])))
+    return FALSE;
+  ev->type = SPIN_EVENT_LEAVE;
+  ev->extra = f[6].str;
+  return TRUE;
 }
 
-static void spin_handle_notify(SpinData* spin,gchar* rest)
+/* <command>#<args> of a '0'-type chat message. Commands without effect
+   still check that we know the room. */
+static gboolean spin_decode_chat_null_msg(SpinData* spin,SpinSpan* f,
+					  SpinSpan* sub,SpinEvent* ev)
 {
-  gchar *ty,*args,*user,*user_2=NULL;
-  spin_split_line(rest,&ty,&user,&args,NULL);
-
-  if(!ty)
-    return;
+  ev->type = SPIN_EVENT_ROOM_CHECK;
+  spin_split(f[4].str,'#',sub,2);
 
-  switch(*ty)
+  switch(spin_null_command(spin,&sub[0],ev))
     {
-    case 'l': /* reload friends */
-      spin_receive_friends(spin);
+    case SPIN_NULL_WARN:
+      /* <user>#<msg>, only operators may warn */
+      if(!(spin_get_flags(f[2].str) & (PURPLE_CBFLAGS_OP|PURPLE_CBFLAGS_HALFOP))
+	 || !sub[1].str)
+	break;
+      spin_split(sub[1].str,'#',sub,2);
+      if(!(ev->user = spin_field_user(spin,&sub[0]))
+	 || (sub[1].str && !(ev->text = spin_field_text(spin,&sub[1]))))
+	break;
+      ev->user_atom = sub[0].atom;
+      ev->type = SPIN_EVENT_WARN;
       break;
-    case 'i': /* room invited */
-      break;
-    case 'j': /* chat with user invited */
-      break;
-    case 'a': /* new mail */
-      spin_check_mail(spin);
+#if SPIN_USE_CBFLAGS_AWAY
+    case SPIN_NULL_AWAY:
+      /* <status>#... */
+      if(!sub[1].str)
+	break;
+      spin_split(sub[1].str,'#',sub,2);
+      ev->type = SPIN_EVENT_CHAT_AWAY;
+      ev->user = ev->other;
+      ev->status = g_ascii_strtoll(sub[0].str,NULL,10);
       break;
-    case 'b': /* new guestbook */
-    case 'c': /* new gift */
-      if((user_2 = spin_convert_user(spin,user)))
-	{
-	  if(*ty == 'b')
-	    spin_notify_guestbook_entry(spin,user);
-	  else
-	    spin_notify_gift(spin,user);
-	  g_free(user_2);
-	}
+#endif
+    default:
       break;
     }
+  return TRUE;
 }
 
-static void spin_handle_list(SpinData* spin,gchar* rest)
+/* g<room>#<user>#<rank>#<type>#<text> */
+static gboolean spin_decode_chat_msg(SpinData* spin,SpinSpan* f,
+				     SpinSpan* sub,SpinEvent* ev)
 {
-  if(!spin->roomlist)
-    return;
-  gchar* room_name;
+  ev->raw_room = f[0].str;
+  ev->kind = f[3].str[0];
+  if(!(ev->room = spin_field_user(spin,&f[0]))
+     || !(ev->other = spin_field_user(spin,&f[1])))
+    return FALSE;
+
+  if(ev->kind == '0')
+    return spin_decode_chat_null_msg(spin,f,sub,ev);
+
+  ev->type = SPIN_EVENT_CHAT_MSG;
+  ev->user = ev->other;
+  ev->other = NULL;
+  ev->body = &f[4];
+  return TRUE;
+}
 
-  while((room_name = simple_strsep(&rest,'#')))
-    {
-      if(!(room_name = spin_convert_user(spin,room_name)))
-	continue;
-      PurpleRoomlistRoom* room =
-	purple_roomlist_room_new(PURPLE_ROOMLIST_ROOMTYPE_ROOM,room_name,NULL);
-      purple_roomlist_room_add_field(spin->roomlist,room,room_name);
-      purple_roomlist_room_add(spin->roomlist,room);
-      g_free(room_name);
-    }
+/* x<user> */
+static gboolean spin_decode_msg_error(SpinData* spin,SpinSpan* f,
+				      SpinSpan* sub,SpinEvent* ev)
+{
+  ev->type = SPIN_EVENT_MSG_ERROR;
+  return (ev->user = spin_field_user(spin,&f[0])) != NULL;
+}
 
-  purple_roomlist_set_in_progress(spin->roomlist,FALSE);
-  purple_roomlist_unref(spin->roomlist);
-  spin->roomlist = NULL;
+/* v<room> */
+static gboolean spin_decode_chat_error(SpinData* spin,SpinSpan* f,
+				       SpinSpan* sub,SpinEvent* ev)
+{
+  ev->type = SPIN_EVENT_CHAT_ERROR;
+  ev->raw_room = f[0].str;
+  return (ev->room = spin_field_user(spin,&f[0])) != NULL;
 }
 
-static void spin_handle_joinleave(SpinData* spin,gchar* rest)
+/* o<room>#<users>#<topic>#<homepage> */
+static gboolean spin_decode_roominfo(SpinData* spin,SpinSpan* f,
+				     SpinSpan* sub,SpinEvent* ev)
 {
-  PurpleAccount* account = purple_connection_get_account(spin->gc);
-  gchar *raw_room,*st,*raw_u1,*raw_u2,*r,*other,*ip,*m,*u1=NULL,*u2=NULL,*room=NULL;
-  static int id = 1;
-  spin_split_line(rest,&raw_room,&st,&raw_u1,&raw_u2,&r,&other,&ip,&m,NULL);
-  gchar *reason = NULL, *normalized_room = NULL;
+  ev->type = SPIN_EVENT_ROOMINFO;
+  ev->raw_room = f[0].str;
+  if(!(ev->room = spin_field_user(spin,&f[0])))
+    return FALSE;
+  ev->text = spin_field_text(spin,&f[2]);
+  ev->extra = spin_field_text(spin,&f[3]);
+  return TRUE;
+}
 
-  if(!(room = spin_convert_user(spin,raw_room))
-       || !(u1 = spin_convert_user(spin,raw_u1))
-       || !(u2 = spin_convert_user(spin,raw_u2)))
-    goto exit;
+/* |<room>#<type>#<user>#<other user>#... */
+static gboolean spin_decode_usermode(SpinData* spin,SpinSpan* f,
+				     SpinSpan* sub,SpinEvent* ev)
+{
+  ev->type = SPIN_EVENT_USERMODE;
+  ev->raw_room = f[0].str;
+  ev->kind = f[1].str[0];
+  return (ev->room = spin_field_user(spin,&f[0]))
+    && (ev->user = spin_field_user(spin,&f[2]))
+    && (ev->other = spin_field_user(spin,&f[3]));
+}
 
-  normalized_room = g_strdup(purple_normalize(account,room));
+/* n<room>#<type>#<args> */
+static gboolean spin_decode_roommode(SpinData* spin,SpinSpan* f,
+				     SpinSpan* sub,SpinEvent* ev)
+{
+  ev->raw_room = f[0].str;
+  ev->kind = f[1].str[0];
 
-  if(g_ascii_islower(*st))
-    { /* join */
-      if(g_strcmp0(purple_normalize(account,u1),spin->normalized_username) == 0)
-	{
-	  g_hash_table_remove(spin->pending_joins,normalized_room);
-	  serv_got_joined_chat(spin->gc,id++,normalized_room);
-	  spin_write_command(spin,'j',raw_room,NULL);
-	  spin_write_command(spin,'o',raw_room,NULL);
-	  spin_chat_set_room_status(spin,room,purple_account_get_active_status(account));
-	}
-      else
-	{
-	  PurpleConversation* conv =
-	    purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT,room,
-						  account);
-	  if(!conv)
-	    {
-	      spin_chat_notfound(spin,room,raw_room);
-	      goto exit;
-	    }
-	  purple_conv_chat_add_user(PURPLE_CONV_CHAT(conv),u1,NULL,
-				    spin_get_flags(r),TRUE);
-	}
+  if(ev->kind == '1')
+    {
+      /* banned ip list */
+      SpinStream* stream = spin_stream_begin(spin,'n',&f[0]);
+      if(f[2].str)
+	spin_stream_entries(spin,stream,f[2].str);
+      spin_stream_end(spin,stream);
+      return FALSE;
     }
-  else
-    { /* leave */
-      if('B' <= *st && *st <= 'M')
-	reason =
-	  g_strdup_printf(g_dgettext(GETTEXT_PACKAGE,leave_reasons[*st-'A']),
-			  u1,room,u2,ip);
 
-      if(g_hash_table_lookup(spin->pending_joins,normalized_room))
-	{
-	  GHashTable* table = g_hash_table_new(g_str_hash,g_str_equal);
-	  g_hash_table_insert(table,"room",normalized_room);
-	  purple_serv_got_join_chat_failed(spin->gc,table);
-	  g_hash_table_unref(table);
-
-	  gchar* head = g_strdup_printf(_("cannot join room %s"),room);
-	  purple_notify_error(spin->gc,head,
-			      reason ? reason : _("no known reason"),NULL);
-	  g_free(head);
-	  g_hash_table_remove(spin->pending_joins,normalized_room);
-
-	  goto exit;
-	}
-      
-      PurpleConversation* conv =
-	purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT,room,
-					      account);
-      if(g_strcmp0(purple_normalize(account,u1),spin->normalized_username) == 0)
-	{
-	  if(conv)
-	    {
-	      gchar* msg = g_strdup_printf(_("You have left the room%s%s%s"),
-					   reason ? " (" : "",
-					   reason ? reason : "",
-					   reason ? ")" : "");
-	      purple_conv_chat_write(PURPLE_CONV_CHAT(conv),"",msg,
-				     PURPLE_MESSAGE_SYSTEM|PURPLE_MESSAGE_NICK,
-				     time(NULL));
-	      serv_got_chat_left
-		(spin->gc,purple_conv_chat_get_id(PURPLE_CONV_CHAT(conv)));
-	      g_free(msg);
-	    }
-	}
-      else
-	{
-	  if(conv)
-	    purple_conv_chat_remove_user(PURPLE_CONV_CHAT(conv),u1,reason);
-	  else
-	    spin_chat_notfound(spin,room,raw_room);
-	}
-    }
+  ev->type = SPIN_EVENT_ROOMMODE;
+  if(!(ev->room = spin_field_user(spin,&f[0])))
+    return FALSE;
 
- exit:
-  g_free(reason);
-  g_free(normalized_room);
-  g_free(room);
-  g_free(u1);
-  g_free(u2);
+  if(ev->kind == 'e' || ev->kind == 'E')
+    {
+      /* <user>#<ip> */
+      if(!f[2].str)
+	return FALSE;
+      spin_split(f[2].str,'#',sub,2);
+      if(!(ev->user = spin_field_user(spin,&sub[0])))
+	return FALSE;
+      ev->extra = sub[1].str;
+    }
+  return TRUE;
 }
 
-static void spin_handle_chat_null_msg(SpinData* spin,gchar* room,gchar* u,
-				      gchar* r,gchar* m)
+/* one fixed arity decoder per opcode of SPIN_PROTO_INBOUND: split into the
+   opcode's fields, returns -1 for a malformed line, else whether an event
+   was decoded */
+#define SPIN_IN_DECODER(op,id,name,prio,min,max)			\
+  static gint spin_in_##id(SpinData* spin,gchar* args,SpinSpan* f,	\
+			   SpinSpan* sub,SpinEvent* ev)			\
+  {									\
+    if(spin_split(args,'#',f,max) < min)				\
+      return -1;							\
+    return spin_decode_##id(spin,f,sub,ev);				\
+  }
+SPIN_PROTO_INBOUND(SPIN_IN_DECODER)
+
+typedef struct
 {
-  gchar *ty,*args,*who=NULL,*msg=NULL,*text=NULL,*escaped_text=NULL;
-  spin_split_line(m,&ty,&args,NULL);
-
-  PurpleAccount* account = purple_connection_get_account(spin->gc);
+  gint (*decode)(SpinData* spin,gchar* args,SpinSpan* fields,SpinSpan* sub,
+		 SpinEvent* ev);
+  const gchar* name;
+  SpinPriority prio;
+  guint8 max_fields;
+} SpinOpcode;
+
+#define SPIN_IN_OPCODE(op,id,name,prio,min,max)				\
+  [op] = {spin_in_##id,name,SPIN_PRIO_##prio,max},
+static const SpinOpcode spin_opcodes[256] =
+  {
+    SPIN_PROTO_INBOUND(SPIN_IN_OPCODE)
+  };
 
-  PurpleConversation* conv =
-    purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT,
-					  room,account);
-  if(!conv)
+void spin_parse_line(SpinData* spin,gchar* line)
+{
+  guchar op = line[0];
+  SpinSpan fields[SPIN_MAX_FIELDS],sub[SPIN_MAX_FIELDS];
+  SpinEvent ev;
+  gint decoded;
+  gint64 start;
+  guint i;
+
+  if(!spin_opcodes[op].decode)
     {
-      gchar* raw_room = spin_encode_room(room);
-      if(raw_room)
-	spin_chat_notfound(spin,room,raw_room);
-      g_free(raw_room);
-      goto exit;
+      purple_debug_info("spin","unrecognized line: %s\n",line);
+      return;
     }
-  
-  if(g_ascii_strcasecmp(ty,"warn") == 0)
+
+  if(spin->text_want > spin->text_size)
     {
-      if(!(spin_get_flags(r) & (PURPLE_CBFLAGS_OP | PURPLE_CBFLAGS_HALFOP)))
-	goto exit;
-      gchar *raw_who,*raw_msg;
-      spin_split_line(args,&raw_who,&raw_msg,NULL);
-      if(!(who = spin_convert_user(spin,raw_who))
-	 || (raw_msg && !(msg = spin_convert_in_text(raw_msg))))
-	goto exit;
-      if(g_strcmp0(purple_normalize(account,who),spin->normalized_username)== 0)
-	{
-	  if(msg && *msg)
-	    text = g_strdup_printf(_("You have been warned by %s: %s"),
-				   u,msg);
-	  else
-	    text = g_strdup_printf(_("You have been warned by %s"),u);
-	  escaped_text = g_markup_escape_text(text,-1);
-	  g_free(text);
-	  /* text is filled in the next line so the last free is ok */
-	  text = g_strdup_printf("<span style=\"color:red\">%s</span>",
-				 escaped_text);
-	  purple_conv_chat_write(PURPLE_CONV_CHAT(conv),u,text,
-				 PURPLE_MESSAGE_NICK|PURPLE_MESSAGE_SYSTEM,
-				 time(NULL));
-	}
-      else
-	{
-	  if(msg && *msg)
-	    text = g_strdup_printf(_("%s has been warned by %s: %s"),
-				   who,u,msg);
-	  else
-	    text = g_strdup_printf(_("%s has been warned by %s"),who,u);
-	  escaped_text = g_markup_escape_text(text,-1);
-	  purple_conv_chat_write(PURPLE_CONV_CHAT(conv),u,escaped_text,
-				 PURPLE_MESSAGE_SYSTEM,
-				 time(NULL));
-	}
+      g_free(spin->text_buf);
+      spin->text_size = spin->text_want;
+      spin->text_buf = g_malloc(spin->text_size);
     }
+  spin->text_used = 0;
+  spin_atoms_trim(spin);
 
-#if SPIN_USE_CBFLAGS_AWAY
-  if(g_ascii_strcasecmp(ty,"away") == 0)
+  for(i = 0; i < SPIN_MAX_FIELDS; ++i)
     {
-      gchar *status,*dummy;
-      spin_split_line(args,&status,&dummy,NULL);
-      if(!status)
-	goto exit;
-      gint status_int = g_ascii_strtoll(status,NULL,10);
-      PurpleConvChatBuddyFlags flags =
-	purple_conv_chat_user_get_flags(PURPLE_CONV_CHAT(conv),u);
-      if(status_int)
-	flags |= PURPLE_CBFLAGS_AWAY;
-      else
-	flags &= ~PURPLE_CBFLAGS_AWAY;
-
-      purple_conv_chat_user_set_flags(PURPLE_CONV_CHAT(conv),u,flags);
+      sub[i].utf8 = NULL;
+      sub[i].atom = NULL;
     }
-#endif
-
- exit:
-  g_free(escaped_text);
-  g_free(text);
-  g_free(who);
-  g_free(msg);
-}
-
-static void spin_handle_chat_msg(SpinData* spin,gchar* rest)
-{
-  PurpleAccount* account = purple_connection_get_account(spin->gc);
-  gchar *raw_room,*raw_u,*r,*ty,*raw_m,*room = NULL,*u = NULL,*m = NULL,
-    *written_m = NULL;
-  spin_split_line(rest,&raw_room,&raw_u,&r,&ty,&raw_m,NULL);
-  if(!(room = spin_convert_user(spin,raw_room))
-     || !(u = spin_convert_user(spin,raw_u))
-     || !(m = spin_convert_in_text(raw_m)))
-    goto exit;
+  memset(&ev,0,sizeof(ev));
+  start = spin->profile ? g_get_monotonic_time() : 0;
+  decoded = spin_opcodes[op].decode(spin,line + 1,fields,sub,&ev);
+  if(decoded < 0)
+    {
+      purple_debug_info("spin","malformed '%c' line\n",op);
+      return;
+    }
+  spin->opcode_stats[op].hits++;
+  if(spin->profile)
+    spin->opcode_stats[op].usecs += g_get_monotonic_time() - start;
 
-  if(*ty == '0')
+  if(decoded)
+    spin_event_apply(spin,&ev);
+  if(ev.null_stats)
     {
-      spin_handle_chat_null_msg(spin,room,u,r,raw_m);
-      goto exit;
+      ev.null_stats->hits++;
+      if(spin->profile)
+	ev.null_stats->usecs += g_get_monotonic_time() - start;
     }
 
-  PurpleMessageFlags flags = 0;
-  if(g_regex_match(spin->nick_regex,m,0,NULL))
-    flags |= PURPLE_MESSAGE_NICK;
+  for(i = 0; i < spin_opcodes[op].max_fields; ++i)
+    spin_field_release(spin,&fields[i]);
+  for(i = 0; i < SPIN_MAX_FIELDS; ++i)
+    spin_field_release(spin,&sub[i]);
+}
 
-  written_m = spin_write_chat(*ty,u,m);
+void spin_parse_log_stats(SpinData* spin)
+{
+  guint i;
+
+  for(i = 0; i < 256; ++i)
+    if(spin->opcode_stats[i].hits)
+      purple_debug_misc("spin","parse: '%c' %s: %u lines, %.1f ms\n",
+			i,spin_opcodes[i].name,spin->opcode_stats[i].hits,
+			spin->opcode_stats[i].usecs / 1000.0);
+  for(i = 0; i < SPIN_NULL_SLOTS; ++i)
+    if(spin->null_stats[i].hits)
+      purple_debug_misc("spin","parse: '0' %s: %u lines, %.1f ms\n",
+			spin_null_commands[i].name,spin->null_stats[i].hits,
+			spin->null_stats[i].usecs / 1000.0);
+}
 
-  PurpleConversation* conv =
-    purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT,room,
-					  account);
-  if(conv)
-    serv_got_chat_in(spin->gc,purple_conv_chat_get_id(PURPLE_CONV_CHAT(conv)),
-		     u,flags,written_m,time(NULL));
-  else
-    spin_chat_notfound(spin,room,raw_room);
+static SpinPriority spin_line_priority(const gchar* line)
+{
+  const gchar* p;
 
- exit:
-  g_free(written_m);
-  g_free(m);
-  g_free(u);
-  g_free(room);
+  /* only the ban list is bulk of the room modes */
+  if(line[0] == 'n' && (p = strchr(line,'#')) && p[1] == '1'
+     && (!p[2] || p[2] == '#'))
+    return SPIN_PRIO_BULK;
+  return spin_opcodes[(guchar) line[0]].prio;
 }
 
-static void spin_handle_chatter_list(SpinData* spin,gchar* rest)
+/* returns the raw room of lines which belong to a room, as a copy */
+static gchar* spin_line_room(const gchar* line,gsize len)
 {
-  PurpleAccount* account = purple_connection_get_account(spin->gc);
-  char *raw_room,*entries,*room = NULL;
-  GList *users=NULL,*flags=NULL;
-  spin_split_line(rest,&raw_room,&entries,NULL);
-  if(!(room = spin_convert_user(spin,raw_room)))
-    goto exit;
-  
-  PurpleConversation* conv;
-  conv = purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT,
-					       room,account);
-  if(!conv)
-    {
-      spin_chat_notfound(spin,room,raw_room);
-      goto exit;
-    }
-  
-  gchar* entry;
-  while((entry = simple_strsep(&entries,'#')))
+  const gchar* p;
+
+  switch(line[0])
     {
-      gchar* name = simple_strsep(&entry,':');
-      gchar* mode = simple_strsep(&entry,':'); 
-      gchar* state = simple_strsep(&entry,':');
-      if(!name || !mode || !state)
-	continue;
-      if(!(name = spin_convert_user(spin,name)))
-	continue;
-      PurpleConvChatBuddyFlags user_flags = spin_get_flags(mode);
-#if SPIN_USE_CBFLAGS_AWAY
-      if(strchr(state,'a'))
-	user_flags |= PURPLE_CBFLAGS_AWAY;
-#endif
-      users = g_list_append(users,name);
-      flags = g_list_append(flags,GINT_TO_POINTER(user_flags));
+    case 'g':
+    case 'j':
+    case 'n':
+    case 'o':
+    case 'v':
+    case '+':
+    case '|':
+      if(!(p = memchr(line + 1,'#',len - 1)))
+	p = line + len;
+      return g_strndup(line + 1,p - line - 1);
+    default:
+      return NULL;
     }
-  purple_conv_chat_add_users(PURPLE_CONV_CHAT(conv),users,NULL,flags,FALSE);
-
- exit:;
-  GList* i;
-  for(i = users; i; i = i->next)
-    g_free(i->data);
-
-  g_list_free(users);
-  g_list_free(flags);
-  g_free(room);
 }
 
-static void spin_handle_msg_error(SpinData* spin,gchar* raw_user)
+gboolean spin_parse_deferred_line(SpinData* spin,const gchar* line,gsize len)
 {
-  PurpleAccount* account = purple_connection_get_account(spin->gc);
-  gchar* user = NULL;
-  if(!(user = spin_convert_user(spin,raw_user)))
-    goto exit;
+  gboolean deferred;
+  gchar* room;
 
-  purple_conv_present_error(user,account,_("error sending message"));
+  if(!g_hash_table_size(spin->deferred_rooms))
+    return FALSE;
+  if(!(room = spin_line_room(line,len)))
+    return FALSE;
 
- exit:
-  g_free(user);
+  deferred = g_hash_table_lookup(spin->deferred_rooms,room) != NULL;
+  g_free(room);
+  return deferred;
 }
 
-static void spin_handle_chat_error(SpinData* spin,gchar* raw_room)
+static void spin_parse_timed(SpinData* spin,SpinPriority prio,gchar* line)
 {
-  gchar* room = NULL;
-  if(!(room = spin_convert_user(spin,raw_room)))
-    goto exit;
+  gint64 start;
 
-
-  if(g_hash_table_lookup(spin->pending_joins,room))
+  spin->stats.lines[prio]++;
+  if(!spin->profile)
     {
-      g_hash_table_remove(spin->pending_joins,room);
-      
-      GHashTable* table = g_hash_table_new(g_str_hash,g_str_equal);
-      g_hash_table_insert(table,"room",room);
-      purple_serv_got_join_chat_failed(spin->gc,table);
-      g_hash_table_unref(table);
+      spin_parse_line(spin,line);
+      return;
     }
-
- exit:
-  g_free(room);
+  start = g_get_monotonic_time();
+  spin_parse_line(spin,line);
+  spin->stats.usecs[prio] += g_get_monotonic_time() - start;
 }
 
-static void spin_handle_roominfo(SpinData* spin,gchar* rest)
+static void spin_parse_defer(SpinData* spin,const gchar* line)
 {
-  gchar *raw_room,*users,*raw_topic,*raw_hp,*room = NULL,*topic=NULL,*hp=NULL;
-  spin_split_line(rest,&raw_room,&users,&raw_topic,&raw_hp,NULL);
-  PurpleAccount* account = purple_connection_get_account(spin->gc);
-  if(!(room = spin_convert_user(spin,raw_room)))
-    goto exit;
+  gsize len = strlen(line);
+  gchar* room = spin_line_room(line,len);
 
-  PurpleConversation* conv;
-  conv = purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT,
-					       room,account);
-  if(!conv)
+  if(room)
     {
-      spin_chat_notfound(spin,room,raw_room);
-      goto exit;
+      guint n = GPOINTER_TO_UINT(g_hash_table_lookup(spin->deferred_rooms,
+						     room));
+      g_hash_table_insert(spin->deferred_rooms,room,GUINT_TO_POINTER(n + 1));
     }
 
-  topic = spin_convert_in_text(raw_topic);
-  hp = spin_convert_in_text(raw_hp);
-  
-  if(hp && *hp)
-    {
-      gchar* text = g_strdup_printf("%s (%s)",topic,hp);
-      purple_conv_chat_set_topic(PURPLE_CONV_CHAT(conv),NULL,text);
-      g_free(text);
-    }
-  else
-      purple_conv_chat_set_topic(PURPLE_CONV_CHAT(conv),NULL,topic);
-
- exit:
-  g_free(room);
-  g_free(topic);
-  g_free(hp);
+  g_queue_push_tail(&spin->deferred,g_strndup(line,len));
+  if(spin->deferred.length > spin->stats.deferred_peak)
+    spin->stats.deferred_peak = spin->deferred.length;
 }
 
-static void spin_handle_usermode(SpinData* spin,gchar* rest)
+static void spin_parse_undefer(SpinData* spin,const gchar* line)
 {
-  gchar *ty,*raw_room,*raw_user,*raw_user_2,*room=NULL,*user=NULL,*user_2=NULL,
-    *formatted_msg = NULL,*dummy,*escaped_msg=NULL;
-  spin_split_line(rest,&raw_room,&ty,&raw_user,&raw_user_2,&dummy,NULL);
-  if( !ty
-      || !(room = spin_convert_user(spin,raw_room))
-      || !(user = spin_convert_user(spin,raw_user))
-      || !(user_2 = spin_convert_user(spin,raw_user_2)))
-    goto exit;
-
-  PurpleAccount* account = purple_connection_get_account(spin->gc);
-  PurpleConversation* conv =
-    purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT,room,account);
-  if(!conv)
-    {
-      spin_chat_notfound(spin,room,raw_room);
-      goto exit;
-    }
+  gchar* room = spin_line_room(line,strlen(line));
+  guint n;
 
-  const gchar* msg = NULL;
-  PurpleConvChatBuddyFlags flags =
-    purple_conv_chat_user_get_flags(PURPLE_CONV_CHAT(conv),user);
-
-  purple_debug_info("spin","flags was %u\n",flags);
+  if(!room)
+    return;
 
-  switch(*ty)
+  n = GPOINTER_TO_UINT(g_hash_table_lookup(spin->deferred_rooms,room));
+  if(n > 1)
+    g_hash_table_insert(spin->deferred_rooms,room,GUINT_TO_POINTER(n - 1));
+  else
     {
-    case 'a':
-      flags |= PURPLE_CBFLAGS_HALFOP; 
-      msg = _("%2$s gives operator rights to %1$s");
-      break;
-    case 'A':
-      flags &= ~PURPLE_CBFLAGS_HALFOP; 
-      msg = _("%2$s removes operator rights from %1$s");
-      break;
-    case 'b':
-      flags |= PURPLE_CBFLAGS_VOICE; 
-      msg = _("%2$s gives voice to %1$s");
-      break;
-    case 'B':
-      flags &= ~PURPLE_CBFLAGS_VOICE; 
-      msg = _("%2$s removes voice from %1$s");
-      break;
+      g_hash_table_remove(spin->deferred_rooms,room);
+      g_free(room);
     }
+}
 
-  purple_debug_info("spin","flags is %u\n",flags);
+static void spin_parse_run_room(SpinData* spin,const gchar* line,gsize len)
+{
+  gchar *room,*queued,*queued_room;
+  GList *l,*next;
 
-  purple_conv_chat_user_set_flags(PURPLE_CONV_CHAT(conv),user,flags);
+  if(!g_hash_table_size(spin->deferred_rooms)
+     || !(room = spin_line_room(line,len)))
+    return;
 
-  if(msg)
+  /* only the room's own lines, the others keep their place */
+  for(l = spin->deferred.head;
+      l && g_hash_table_lookup(spin->deferred_rooms,room); l = next)
     {
-      formatted_msg = g_strdup_printf(msg,user,user_2);
-      escaped_msg = g_markup_escape_text(formatted_msg,-1);
-      purple_conv_chat_write(PURPLE_CONV_CHAT(conv),user,escaped_msg,
-			     PURPLE_MESSAGE_SYSTEM,
-			     time(NULL));
+      next = l->next;
+      queued = l->data;
+      queued_room = spin_line_room(queued,strlen(queued));
+      if(g_strcmp0(queued_room,room) == 0)
+	{
+	  g_queue_delete_link(&spin->deferred,l);
+	  spin_parse_undefer(spin,queued);
+	  spin_parse_timed(spin,spin_line_priority(queued),queued);
+	  g_free(queued);
+	}
+      g_free(queued_room);
     }
-
- exit:
-  g_free(escaped_msg);
-  g_free(formatted_msg);
-  g_free(user);
-  g_free(user_2);
   g_free(room);
 }
 
-void spin_handle_roommode(SpinData* spin,gchar* rest)
+gsize spin_parse_partial(SpinData* spin,gchar* partial,gsize len)
 {
-  gchar *ty,*args,*msg = NULL,*ip=NULL,*raw_user=NULL,*user=NULL,
-    *raw_room,*room=NULL,*timecode;
-  const gchar *msg_fmt;
-  PurpleConversation* conv;
-  PurpleAccount* account;
-  GString* msg_str = NULL;
-
-  account = purple_connection_get_account(spin->gc);
-
-  spin_split_line(rest,&raw_room,&ty,&args,NULL);
-  if(!ty
-     || !(room = spin_convert_user(spin,raw_room)))
-    return;
+  gsize head = 0;
+  gchar *p;
+  SpinSpan room;
+  gint64 start;
 
-  conv = purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT,room,
-					       account);
-  if(!conv)
+  if(!spin->stream)
     {
-      spin_chat_notfound(spin,room,raw_room);
-      goto exit;
-    }
+      if(len < SPIN_STREAM_MIN_LEN)
+	return 0;
 
-  switch(*ty)
-    {
-    case '1':
-      /* banned ip list */
+      /* earlier lines for the same room have to be handled first */
+      spin_parse_run_room(spin,partial,len);
 
-      msg_str = g_string_new(_("Banned IP addresses:"));
-      g_string_append(msg_str,"<ul>");
-      
-      while(args)
+      switch(partial[0])
 	{
-	  spin_split_line(args,&raw_user,&timecode,&args,NULL);
-	  if(!raw_user
-	     || !(user = spin_convert_user(spin,raw_user)))
-	    continue;
-
-	  if(*user)
-	    {
-	      gchar* part;
-	      part = g_markup_printf_escaped("<li>%s</li>",user);
-	      g_string_append(msg_str,part);
-	      g_free(part);
-	    }
-
-	  g_free(user);
+	case 'l':
+	  spin->stream = spin_stream_begin(spin,'l',NULL);
+	  head = 1;
+	  break;
+	case 'j':
+	  if(!(p = memchr(partial + 1,'#',len - 1)))
+	    return 0;
+	  *p = '\0';
+	  room.str = partial + 1;
+	  room.len = p - room.str;
+	  spin->stream = spin_stream_begin(spin,'j',&room);
+	  head = p + 1 - partial;
+	  break;
+	case 'n':
+	  /* only the ban list (type 1) can get big */
+	  if(!(p = memchr(partial + 1,'#',len - 1))
+	     || p + 3 > partial + len || p[1] != '1' || p[2] != '#')
+	    return 0;
+	  *p = '\0';
+	  room.str = partial + 1;
+	  room.len = p - room.str;
+	  spin->stream = spin_stream_begin(spin,'n',&room);
+	  head = p + 3 - partial;
+	  break;
+	default:
+	  return 0;
 	}
-      user = NULL;
-
-      g_string_append(msg_str,"</ul>");
-      msg = g_string_free(msg_str,FALSE);
-      break;
-    case 'e': /* banned */
-    case 'E': /* unbanned */
-      if(*ty == 'e')
-        msg_fmt = _("IP address %1$s has been banned by %2$s");
-      else
-	msg_fmt = _("IP address %1$s's ban has been removed by %2$s");
-      spin_split_line(args,&raw_user,&ip,NULL);
-      if(!(user = spin_convert_user(spin,raw_user)))
-	goto exit;
-      msg = g_markup_printf_escaped(msg_fmt,ip,user);
-      break;
-    case 'i':
-      msg = g_strdup(_("The room locked for unregistered users"));
-      break;
     }
 
-  if(!msg)
-    goto exit;
-
-  purple_conv_chat_write(PURPLE_CONV_CHAT(conv),"",msg,
-			 PURPLE_MESSAGE_SYSTEM,time(NULL));
+  /* hand out all complete entries, the last one might still grow */
+  for(p = partial + len; p != partial + head; --p)
+    if(p[-1] == '#')
+      break;
+  if(p == partial + head)
+    return head;
+
+  p[-1] = '\0';
+  start = g_get_monotonic_time();
+  spin_atoms_trim(spin);
+  spin_stream_entries(spin,spin->stream,partial + head);
+  spin->stream_usecs += g_get_monotonic_time() - start;
+  return p - partial;
+}
 
- exit:
-  g_free(msg);
-  g_free(user);
-  g_free(room);
+void spin_parse_dispatch(SpinData* spin,gchar* line)
+{
+  SpinPriority prio;
+
+  if(spin->stream)
+    { /* the rest of a line we started to handle in spin_parse_partial */
+      SpinStream* stream = spin->stream;
+      gint64 start = g_get_monotonic_time();
+      spin->stream = NULL;
+      spin_atoms_trim(spin);
+      spin_stream_entries(spin,stream,line);
+      spin_stream_end(spin,stream);
+      start = g_get_monotonic_time() - start;
+      spin->stats.lines[SPIN_PRIO_BULK]++;
+      spin->stats.usecs[SPIN_PRIO_BULK] += start;
+      spin->stream_usecs += start;
+      return;
+    }
+
+  prio = spin_line_priority(line);
+  if(prio == SPIN_PRIO_BULK || spin_parse_deferred_line(spin,line,strlen(line)))
+    spin_parse_defer(spin,line);
+  else
+    spin_parse_timed(spin,prio,line);
 }
 
-void spin_parse_line(SpinData* spin,gchar* line)
+gboolean spin_parse_run_deferred(SpinData* spin)
 {
-#define HANDLE(CH,FUNC)						\
-  case CH:							\
-    FUNC(spin,line+1);						\
-    break
-  switch(line[0])
+  /* streamed lists already used part of the slice */
+  gint64 start = g_get_monotonic_time() - spin->stream_usecs;
+  gchar* line;
+
+  spin->stream_usecs = 0;
+  while(g_get_monotonic_time() - start < SPIN_BULK_BUDGET
+	&& (line = g_queue_pop_head(&spin->deferred)))
     {
-      HANDLE('a',spin_handle_connected);
-      HANDLE('e',spin_handle_disconnected);
-      HANDLE('h',spin_handle_private_msg);
-      HANDLE('=',spin_handle_status);
-      HANDLE('>',spin_handle_notify);
-      HANDLE('J',spin_handle_ping);
-      HANDLE('l',spin_handle_list);
-      HANDLE('+',spin_handle_joinleave);
-      HANDLE('g',spin_handle_chat_msg);
-      HANDLE('j',spin_handle_chatter_list);
-      HANDLE('x',spin_handle_msg_error);
-      HANDLE('v',spin_handle_chat_error);
-      HANDLE('o',spin_handle_roominfo);
-      HANDLE('|',spin_handle_usermode);
-      HANDLE('n',spin_handle_roommode);
-    default:
-      purple_debug_info("spin","unrecognized line: %s\n",line);
+      spin_parse_undefer(spin,line);
+      spin_parse_timed(spin,spin_line_priority(line),line);
+      g_free(line);
     }
-}
 
+  spin_chat_flush_members(spin,NULL);
+  return !g_queue_is_empty(&spin->deferred);
+}
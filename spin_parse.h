@@ -20,8 +20,50 @@
 
 #include "spin.h"
 
+/* a field of a received line, NUL terminated in place, and its UTF-8
+   form once it has been decoded */
+typedef struct
+{
+  gchar* str;
+  gsize len;
+  gchar* utf8;
+  SpinAtom* atom; /* for user and room names */
+} SpinSpan;
+
+/* most fields a line is split into, see SPIN_PROTO_INBOUND */
+#define SPIN_MAX_FIELDS 8
+
+/* the atom of a user or room field, looked up the first time it is read */
+SpinAtom* spin_field_atom(SpinData* spin,SpinSpan* f);
+/* the UTF-8 form of the field's atom */
+gchar* spin_field_user(SpinData* spin,SpinSpan* f);
+/* like spin_field_user, but for message texts which may be UTF-8 already.
+   The result is usually placed in the session's text buffer, so decoding
+   a message needs no allocation. */
+gchar* spin_field_text(SpinData* spin,SpinSpan* f);
+
+/* decodes the line into a SpinEvent and applies it */
 void spin_parse_line(SpinData* spin,gchar* line);
+/* logs hits and time per opcode and per '0' sub-command */
+void spin_parse_log_stats(SpinData* spin);
+/* handles the already received part of an incomplete line, returns the
+   number of bytes which have been consumed */
+gsize spin_parse_partial(SpinData* spin,gchar* partial,gsize len);
+void spin_parse_reset(SpinData* spin);
+
+/* handles control and interactive lines at once and queues bulk lines,
+   and all later lines of the same room, for spin_parse_run_deferred */
+void spin_parse_dispatch(SpinData* spin,gchar* line);
+/* handles queued lines for at most SPIN_BULK_BUDGET usec, less the time
+   lists streamed in since the last call took. Returns TRUE if some are
+   left. */
+gboolean spin_parse_run_deferred(SpinData* spin);
+/* whether the line belongs to a room which has queued lines */
+gboolean spin_parse_deferred_line(SpinData* spin,const gchar* line,gsize len);
 
-gchar* spin_write_chat(gchar ty,const gchar* user,const gchar* t);
+/* renders a message of type ty from user as markup into out, which is
+   cleared first. Returns out->str. */
+const gchar* spin_write_chat(GString* out,gchar ty,const gchar* user,
+			     const gchar* t);
 
 #endif
@@ -0,0 +1,52 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+#include "spin_patterns.h"
+
+static gpointer spin_patterns_compile(gpointer data G_GNUC_UNUSED)
+{
+  static SpinPatterns patterns;
+  GError* error = NULL;
+
+  patterns.string_literal = g_regex_new
+    ("(['\"])((?:(?!\\1)[^\\x00-\\x1f\\\\]||\\\\[\\\\/bfnrt]|\\\\\\1"
+     "|\\\\u[0-9a-fA-F]{4}|\\\\[\\x20-\\xff])*)\\1",G_REGEX_OPTIMIZE,0,&error);
+  g_assert(error == NULL);
+
+  patterns.head_info =
+    xmlXPathCompile((xmlChar*)"string(//div[@class='sbox']/p)");
+  patterns.img_info =
+    xmlXPathCompile((xmlChar*)"string(//img[@class='thumb']/@src)");
+  patterns.profile_labels = xmlXPathCompile((xmlChar*)"//*[@class='label']");
+  patterns.profile_siblings =
+    xmlXPathCompile((xmlChar*)"following-sibling::text()"
+		    "|following-sibling::*");
+  g_assert(patterns.head_info && patterns.img_info
+	   && patterns.profile_labels && patterns.profile_siblings);
+
+  return &patterns;
+}
+
+void spin_patterns_init(void)
+{
+  spin_patterns();
+}
+
+const SpinPatterns* spin_patterns(void)
+{
+  static GOnce once = G_ONCE_INIT;
+  return g_once(&once,spin_patterns_compile,NULL);
+}
@@ -0,0 +1,39 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef SPIN_PATTERNS_H_
+#define SPIN_PATTERNS_H_
+
+#include <glib.h>
+#include <libxml/xpath.h>
+
+/* the fixed regular expressions and XPath expressions of the plugin,
+   compiled once and shared read-only by all connections and threads */
+typedef struct
+{
+  GRegex* string_literal; /* a quoted javascript string */
+  xmlXPathCompExprPtr head_info;
+  xmlXPathCompExprPtr img_info;
+  xmlXPathCompExprPtr profile_labels;
+  xmlXPathCompExprPtr profile_siblings;
+} SpinPatterns;
+
+/* compiles the patterns, called from init_plugin */
+void spin_patterns_init(void);
+/* the compiled patterns, compiling them first if needed */
+const SpinPatterns* spin_patterns(void);
+
+#endif
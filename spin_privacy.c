@@ -18,6 +18,8 @@
 #include "spin_privacy.h"
 #include "spin_web.h"
 #include "spin_login.h"
+#include "spin_proto.h"
+#include "spin_atom.h"
 
 #include "debug.h"
 #include "privacy.h"
@@ -203,13 +205,11 @@ void spin_ignore_user(SpinData* spin,const gchar* name)
   g_return_if_fail(spin);
   g_return_if_fail(name);
 
-  gchar* encoded_user = spin_encode_user(name);
-  if(!encoded_user)
+  SpinAtom* atom = spin_atom_utf8(spin,name);
+  if(!atom)
     return;
 
-  spin_write_command(spin,'w',encoded_user,NULL);
-
-  g_free(encoded_user);
+  spin_send_ignore(spin,atom->raw);
 }
 
 void spin_unignore_user(SpinData* spin,const gchar* name)
@@ -217,13 +217,13 @@ void spin_unignore_user(SpinData* spin,const gchar* name)
   g_return_if_fail(spin);
   g_return_if_fail(name);
   
-  gchar* encoded_user = spin_encode_user(name);
+  SpinAtom* atom = spin_atom_utf8(spin,name);
   PurpleAccount* account = purple_connection_get_account(spin->gc);
   GList* chats;
-  if(!encoded_user)
+  if(!atom)
     return;
 
-  spin_write_command(spin,'O',encoded_user,NULL);
+  spin_send_unignore(spin,atom->raw);
 
   /* the javascript code refetches chatter lists,so we do this too */
   for(chats = purple_get_chats(); chats; chats = g_list_next(chats))
@@ -232,14 +232,12 @@ void spin_unignore_user(SpinData* spin,const gchar* name)
       if(purple_conversation_get_account(conv) != account)
 	continue;
 
-      gchar* encoded_room =
-	spin_encode_user(purple_conversation_get_name(conv));
+      SpinAtom* room =
+	spin_atom_utf8(spin,purple_conversation_get_name(conv));
       purple_conv_chat_clear_users(PURPLE_CONV_CHAT(conv));
-      spin_write_command(spin,'j',encoded_room,NULL);
-      g_free(encoded_room);
+      if(room)
+	spin_send_chatters(spin,room->raw);
     }
-
-  g_free(encoded_user);
 }
 
 void spin_add_deny(PurpleConnection* gc,const gchar* name)
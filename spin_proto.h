@@ -0,0 +1,186 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef SPIN_PROTO_H_
+#define SPIN_PROTO_H_
+
+#include "spin.h"
+
+#include <string.h>
+
+/* The protocol schema. Every line is an opcode byte followed by fields
+   separated by '#' and ends with '\n'. The tables below are expanded by
+   the preprocessor into the opcode table and one fixed arity encoder per
+   outbound command, so the wire format is only written down here. */
+
+/* inbound: opcode, decoder, name, priority class, min and max fields.
+   A line is split into at most max fields, the last one keeps the rest of
+   the line; lines with less than min fields are dropped. */
+#define SPIN_PROTO_INBOUND(X)						\
+  X('a',connected,"connected",CONTROL,1,1)				\
+  X('e',disconnected,"disconnected",CONTROL,1,1)			\
+  /* user#0#unused#type#text */						\
+  X('h',private_msg,"private msg",INTERACTIVE,5,5)			\
+  /* type[#args] */							\
+  X('=',status,"status",INTERACTIVE,1,2)				\
+  /* type[#user[#args]] */						\
+  X('>',notify,"notify",INTERACTIVE,1,3)				\
+  X('J',ping,"ping",CONTROL,1,1)					\
+  X('l',list,"room list",BULK,1,1)					\
+  /* room#type#user#other#flags#... */					\
+  X('+',joinleave,"join/leave",INTERACTIVE,4,8)				\
+  /* room#user#flags#type#text */					\
+  X('g',chat_msg,"chat msg",INTERACTIVE,5,5)				\
+  X('j',chatter_list,"chatter list",BULK,1,2)				\
+  X('x',msg_error,"msg error",CONTROL,1,1)				\
+  X('v',chat_error,"chat error",CONTROL,1,1)				\
+  /* room[#unused[#topic[#owner]]] */					\
+  X('o',roominfo,"room info",INTERACTIVE,1,4)				\
+  /* room#mode#user#other[#...] */					\
+  X('|',usermode,"user mode",INTERACTIVE,4,5)				\
+  /* room#type[#args] */						\
+  X('n',roommode,"room mode",INTERACTIVE,2,3)
+
+/* how an outbound field is put on the wire. RAW fields are protocol
+   tokens and copied as they are, NAME (ISO-8859-15 user or room names,
+   already encoded) and TEXT fields get newlines replaced by spaces.
+   HTML fields are message markup from the UI and are sanitized on the
+   way into the line, see spin_text_out. SAY is an HTML message preceded
+   by its type field, 'c' if it started with /me and 'a' otherwise. */
+typedef enum
+  {
+    SPIN_ENC_RAW,
+    SPIN_ENC_NAME,
+    SPIN_ENC_TEXT,
+    SPIN_ENC_HTML,
+    SPIN_ENC_SAY
+  } SpinEncoding;
+
+typedef struct
+{
+  const gchar* str;
+  gsize len;
+  SpinEncoding enc;
+} SpinOutField;
+
+/* outbound: encoder name, opcode, then an encoding and a parameter name
+   per field. Each row becomes spin_send_<name>(spin,fields...). */
+#define SPIN_PROTO_OUTBOUND(C0,C1,C2,C3,C4,C5)				\
+  /* login */								\
+  C1(client,'A',RAW,client)						\
+  C1(agent,'B',RAW,agent)						\
+  C2(login,'a',NAME,user,RAW,session)					\
+  C1(ping,'J',RAW,kind)							\
+  /* private messages and status */					\
+  C4(msg,'h',NAME,user,RAW,flag,RAW,ty,TEXT,text)			\
+  C3(im_say,'h',NAME,user,RAW,flag,SAY,html)				\
+  C3(away,'W',RAW,state,RAW,ty,HTML,html)				\
+  C1(ignore,'w',NAME,user)						\
+  C1(unignore,'O',NAME,user)						\
+  /* rooms */								\
+  C0(room_list,'l')							\
+  C1(join,'c',NAME,room)						\
+  C1(leave,'d',NAME,room)						\
+  C1(chatters,'j',NAME,room)						\
+  C1(room_info,'o',NAME,room)						\
+  C3(chat_msg,'g',NAME,room,RAW,ty,TEXT,text)				\
+  C2(chat_say,'g',NAME,room,SAY,html)					\
+  C4(chat_away,'g',NAME,room,RAW,flag,RAW,ty,RAW,state)			\
+  C5(chat_warn,'g',NAME,room,RAW,flag,RAW,ty,NAME,user,TEXT,text)	\
+  /* moderation */							\
+  C1(srv_kick,'1',NAME,user)						\
+  C2(srv_ban,'2',RAW,ty,NAME,user)					\
+  C1(srv_mute,'E',NAME,user)						\
+  C2(kick,'f',NAME,user,NAME,room)					\
+  C3(room_query,'t',NAME,room,RAW,ty,TEXT,arg)				\
+  C4(room_ban,'t',NAME,room,RAW,ty,RAW,scope,TEXT,arg)			\
+  C4(room_flags,'|',NAME,room,RAW,flags,NAME,user,RAW,extra)
+
+/* most fields spin_write_command takes */
+#define SPIN_MAX_OUT_FIELDS 8
+
+/* encodes cmd and its n fields and queues the line for sending */
+void spin_write_fields(SpinData* spin,gchar cmd,const SpinOutField* f,
+		       guint n);
+
+#define SPIN_OUT_PARAM(enc,arg) ,const gchar* arg
+#define SPIN_OUT_FIELD(enc,arg) {arg,strlen(arg),SPIN_ENC_##enc},
+
+#define SPIN_OUT0(id,op)						\
+  static inline void spin_send_##id(SpinData* spin)			\
+  {									\
+    spin_write_fields(spin,op,NULL,0);					\
+  }
+#define SPIN_OUT1(id,op,e1,a1)						\
+  static inline void spin_send_##id(SpinData* spin			\
+				    SPIN_OUT_PARAM(e1,a1))		\
+  {									\
+    const SpinOutField f[] = {SPIN_OUT_FIELD(e1,a1)};			\
+    spin_write_fields(spin,op,f,1);					\
+  }
+#define SPIN_OUT2(id,op,e1,a1,e2,a2)					\
+  static inline void spin_send_##id(SpinData* spin			\
+				    SPIN_OUT_PARAM(e1,a1)		\
+				    SPIN_OUT_PARAM(e2,a2))		\
+  {									\
+    const SpinOutField f[] = {SPIN_OUT_FIELD(e1,a1)			\
+			      SPIN_OUT_FIELD(e2,a2)};			\
+    spin_write_fields(spin,op,f,2);					\
+  }
+#define SPIN_OUT3(id,op,e1,a1,e2,a2,e3,a3)				\
+  static inline void spin_send_##id(SpinData* spin			\
+				    SPIN_OUT_PARAM(e1,a1)		\
+				    SPIN_OUT_PARAM(e2,a2)		\
+				    SPIN_OUT_PARAM(e3,a3))		\
+  {									\
+    const SpinOutField f[] = {SPIN_OUT_FIELD(e1,a1)			\
+			      SPIN_OUT_FIELD(e2,a2)			\
+			      SPIN_OUT_FIELD(e3,a3)};			\
+    spin_write_fields(spin,op,f,3);					\
+  }
+#define SPIN_OUT4(id,op,e1,a1,e2,a2,e3,a3,e4,a4)			\
+  static inline void spin_send_##id(SpinData* spin			\
+				    SPIN_OUT_PARAM(e1,a1)		\
+				    SPIN_OUT_PARAM(e2,a2)		\
+				    SPIN_OUT_PARAM(e3,a3)		\
+				    SPIN_OUT_PARAM(e4,a4))		\
+  {									\
+    const SpinOutField f[] = {SPIN_OUT_FIELD(e1,a1)			\
+			      SPIN_OUT_FIELD(e2,a2)			\
+			      SPIN_OUT_FIELD(e3,a3)			\
+			      SPIN_OUT_FIELD(e4,a4)};			\
+    spin_write_fields(spin,op,f,4);					\
+  }
+#define SPIN_OUT5(id,op,e1,a1,e2,a2,e3,a3,e4,a4,e5,a5)			\
+  static inline void spin_send_##id(SpinData* spin			\
+				    SPIN_OUT_PARAM(e1,a1)		\
+				    SPIN_OUT_PARAM(e2,a2)		\
+				    SPIN_OUT_PARAM(e3,a3)		\
+				    SPIN_OUT_PARAM(e4,a4)		\
+				    SPIN_OUT_PARAM(e5,a5))		\
+  {									\
+    const SpinOutField f[] = {SPIN_OUT_FIELD(e1,a1)			\
+			      SPIN_OUT_FIELD(e2,a2)			\
+			      SPIN_OUT_FIELD(e3,a3)			\
+			      SPIN_OUT_FIELD(e4,a4)			\
+			      SPIN_OUT_FIELD(e5,a5)};			\
+    spin_write_fields(spin,op,f,5);					\
+  }
+
+SPIN_PROTO_OUTBOUND(SPIN_OUT0,SPIN_OUT1,SPIN_OUT2,SPIN_OUT3,SPIN_OUT4,
+		    SPIN_OUT5)
+
+#endif
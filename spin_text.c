@@ -0,0 +1,481 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+#include "spin_text.h"
+
+#include "util.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define SPIN_TEXT_X86 1
+#  include <immintrin.h>
+#endif
+
+/* ISO-8859-1 but for eight characters */
+static const gunichar spin_latin9[256] =
+  {
+#define SPIN_ROW(b) b,b + 1,b + 2,b + 3,b + 4,b + 5,b + 6,b + 7,	\
+    b + 8,b + 9,b + 10,b + 11,b + 12,b + 13,b + 14,b + 15
+    SPIN_ROW(0x00),SPIN_ROW(0x10),SPIN_ROW(0x20),SPIN_ROW(0x30),
+    SPIN_ROW(0x40),SPIN_ROW(0x50),SPIN_ROW(0x60),SPIN_ROW(0x70),
+    SPIN_ROW(0x80),SPIN_ROW(0x90),
+    0xa0,0xa1,0xa2,0xa3,0x20ac,0xa5,0x0160,0xa7,
+    0x0161,0xa9,0xaa,0xab,0xac,0xad,0xae,0xaf,
+    0xb0,0xb1,0xb2,0xb3,0x017d,0xb5,0xb6,0xb7,
+    0x017e,0xb9,0xba,0xbb,0x0152,0x0153,0x0178,0xbf,
+    SPIN_ROW(0xc0),SPIN_ROW(0xd0),SPIN_ROW(0xe0),SPIN_ROW(0xf0)
+#undef SPIN_ROW
+  };
+
+typedef gsize (*SpinAsciiFunc)(const guchar* p,gsize len);
+
+static SpinAsciiFunc spin_ascii;
+
+static gsize spin_ascii_scalar(const guchar* p,gsize len)
+{
+  gsize i = 0;
+  guint64 w;
+
+  /* eight bytes at a time while no high bit is set */
+  for(; i + 8 <= len; i += 8)
+    {
+      memcpy(&w,p + i,8);
+      if(w & G_GUINT64_CONSTANT(0x8080808080808080))
+	break;
+    }
+  while(i < len && p[i] < 0x80)
+    ++i;
+  return i;
+}
+
+#if SPIN_TEXT_X86
+__attribute__((target("sse2")))
+static gsize spin_ascii_sse2(const guchar* p,gsize len)
+{
+  gsize i;
+
+  for(i = 0; i + 16 <= len; i += 16)
+    {
+      guint32 high =
+	_mm_movemask_epi8(_mm_loadu_si128((const __m128i*) (p + i)));
+      if(high)
+	return i + __builtin_ctz(high);
+    }
+
+  return i + spin_ascii_scalar(p + i,len - i);
+}
+#endif
+
+gsize spin_text_ascii_prefix(const gchar* in,gsize len)
+{
+  if(!spin_ascii)
+    {
+      spin_ascii = spin_ascii_scalar;
+#if SPIN_TEXT_X86
+      __builtin_cpu_init();
+      if(__builtin_cpu_supports("sse2"))
+	spin_ascii = spin_ascii_sse2;
+#endif
+    }
+  return spin_ascii((const guchar*) in,len);
+}
+
+static gsize spin_latin9_decode(const guchar* p,gsize n,gchar* q)
+{
+  gchar* start = q;
+  gsize i;
+
+  for(i = 0; i < n; ++i)
+    {
+      gunichar c = spin_latin9[p[i]];
+      if(c < 0x80)
+	*q++ = c;
+      else if(c < 0x800)
+	{
+	  *q++ = 0xc0 | (c >> 6);
+	  *q++ = 0x80 | (c & 0x3f);
+	}
+      else
+	{
+	  *q++ = 0xe0 | (c >> 12);
+	  *q++ = 0x80 | ((c >> 6) & 0x3f);
+	  *q++ = 0x80 | (c & 0x3f);
+	}
+    }
+  return q - start;
+}
+
+gchar* spin_latin9_to_utf8(const gchar* in,gssize len)
+{
+  g_return_val_if_fail(in,NULL);
+
+  gsize n = len < 0 ? strlen(in) : (gsize) len;
+  gsize ascii = spin_text_ascii_prefix(in,n);
+  gchar* out = g_malloc(SPIN_TEXT_IN_MAX(n));
+
+  memcpy(out,in,ascii);
+  out[ascii + spin_latin9_decode((const guchar*) in + ascii,n - ascii,
+				 out + ascii)] = '\0';
+  return out;
+}
+
+/* 0 for what g_utf8_validate rejects */
+static inline gsize spin_utf8_sequence(const guchar* p,gsize n)
+{
+  if(p[0] >= 0xc2 && p[0] < 0xe0)
+    return n >= 2 && (p[1] & 0xc0) == 0x80 ? 2 : 0;
+
+  if(p[0] >= 0xe0 && p[0] < 0xf0)
+    {
+      if(n < 3 || (p[1] & 0xc0) != 0x80 || (p[2] & 0xc0) != 0x80
+	 || (p[0] == 0xe0 && p[1] < 0xa0)     /* overlong */
+	 || (p[0] == 0xed && p[1] >= 0xa0))   /* surrogate */
+	return 0;
+      return 3;
+    }
+
+  if(p[0] >= 0xf0 && p[0] < 0xf5)
+    {
+      if(n < 4 || (p[1] & 0xc0) != 0x80 || (p[2] & 0xc0) != 0x80
+	 || (p[3] & 0xc0) != 0x80
+	 || (p[0] == 0xf0 && p[1] < 0x90)     /* overlong */
+	 || (p[0] == 0xf4 && p[1] >= 0x90))   /* above U+10FFFF */
+	return 0;
+      return 4;
+    }
+
+  return 0;
+}
+
+gsize spin_text_in_utf8(const gchar* in,gsize len,gchar* out)
+{
+  const guchar* p = (const guchar*) in;
+  gsize first = spin_text_ascii_prefix(in,len);
+  gsize i = first,n;
+
+  memcpy(out,in,first);
+  while(i < len)
+    {
+      if(!(n = spin_utf8_sequence(p + i,len - i)))
+	goto latin9;
+      memcpy(out + i,p + i,n);
+      i += n;
+
+      n = spin_text_ascii_prefix(in + i,len - i);
+      memcpy(out + i,p + i,n);
+      i += n;
+    }
+  out[len] = '\0';
+  return len;
+
+ latin9:
+  n = first + spin_latin9_decode(p + first,len - first,out + first);
+  out[n] = '\0';
+  return n;
+}
+
+static inline gint spin_latin9_byte(gunichar c)
+{
+  if(c < 0x100)
+    return spin_latin9[c] == c ? (gint) c : -1;
+
+  switch(c)
+    {
+    case 0x20ac: return 0xa4;
+    case 0x0160: return 0xa6;
+    case 0x0161: return 0xa8;
+    case 0x017d: return 0xb4;
+    case 0x017e: return 0xb8;
+    case 0x0152: return 0xbc;
+    case 0x0153: return 0xbd;
+    case 0x0178: return 0xbe;
+    default: return -1;
+    }
+}
+
+gchar* spin_utf8_to_latin9(const gchar* in,gssize len)
+{
+  g_return_val_if_fail(in,NULL);
+
+  const guchar* p = (const guchar*) in;
+  gsize n = len < 0 ? strlen(in) : (gsize) len;
+  gsize i = spin_text_ascii_prefix(in,n);
+  /* the result is never longer than the input */
+  gchar* out = g_malloc(n + 1);
+  gchar* q = out + i;
+
+  memcpy(out,in,i);
+  while(i < n)
+    {
+      gunichar c = p[i];
+      gint b;
+
+      if(c < 0x80)
+	{
+	  *q++ = c;
+	  ++i;
+	  continue;
+	}
+      /* only two and three byte sequences can map to ISO-8859-15 */
+      if(c >= 0xc2 && c < 0xe0 && i + 1 < n
+	 && (p[i + 1] & 0xc0) == 0x80)
+	{
+	  c = ((c & 0x1f) << 6) | (p[i + 1] & 0x3f);
+	  i += 2;
+	}
+      else if(c >= 0xe0 && c < 0xf0 && i + 2 < n
+	      && (p[i + 1] & 0xc0) == 0x80 && (p[i + 2] & 0xc0) == 0x80)
+	{
+	  c = ((c & 0x0f) << 12) | ((p[i + 1] & 0x3f) << 6)
+	    | (p[i + 2] & 0x3f);
+	  i += 3;
+	  if(c < 0x800)
+	    goto error;
+	}
+      else
+	goto error;
+
+      if((b = spin_latin9_byte(c)) < 0)
+	goto error;
+      *q++ = b;
+    }
+  *q = '\0';
+  return out;
+
+ error:
+  g_free(out);
+  return NULL;
+}
+
+#define SPIN_TAG(s,tag) (g_ascii_strncasecmp((s),(tag),sizeof(tag) - 1) == 0)
+
+/* purple_markup_strip_html, but newlines become spaces */
+static gsize spin_strip_html(const gchar* in,gchar* out,gboolean* nl_at_me)
+{
+  const gchar* cdata_close_tag = NULL,*ent;
+  gboolean visible = TRUE,closing_td_p = FALSE;
+  gchar* href = NULL;
+  gsize i,j,k,href_st = 0;
+  gint entlen;
+
+#define SPIN_PUT_NL() do { if(j == 3) *nl_at_me = TRUE; out[j++] = ' '; } \
+  while(0)
+
+  for(i = 0,j = 0; in[i]; i++)
+    {
+      if(in[i] == '<')
+	{
+	  if(cdata_close_tag)
+	    {
+	      if(g_ascii_strncasecmp(in + i,cdata_close_tag,
+				     strlen(cdata_close_tag)) == 0)
+		{
+		  i += strlen(cdata_close_tag) - 1;
+		  cdata_close_tag = NULL;
+		}
+	      continue;
+	    }
+	  else if(SPIN_TAG(in + i,"<td") && closing_td_p)
+	    {
+	      out[j++] = '\t';
+	      visible = TRUE;
+	    }
+	  else if(SPIN_TAG(in + i,"</td>"))
+	    {
+	      closing_td_p = TRUE;
+	      visible = FALSE;
+	    }
+	  else
+	    {
+	      closing_td_p = FALSE;
+	      visible = TRUE;
+	    }
+
+	  k = i + 1;
+	  if(g_ascii_isspace(in[k]))
+	    visible = TRUE;
+	  else if(in[k])
+	    {
+	      while(in[k] && in[k] != '<' && in[k] != '>')
+		k++;
+
+	      /* the address of a link is printed after its text */
+	      if(SPIN_TAG(in + i,"<a") && g_ascii_isspace(in[i + 2]))
+		{
+		  gsize st,end;
+		  gchar delim = ' ';
+		  for(st = i + 3; st < k; st++)
+		    if(SPIN_TAG(in + st,"href="))
+		      {
+			st += 5;
+			if(in[st] == '"' || in[st] == '\'')
+			  delim = in[st++];
+			break;
+		      }
+		  for(end = st; end < k && in[end] != delim; end++)
+		    ;
+		  if(st < k)
+		    {
+		      gchar* tmp = g_strndup(in + st,end - st);
+		      g_free(href);
+		      href = purple_unescape_html(tmp);
+		      g_free(tmp);
+		      /* an escaped line break must not end the command */
+		      for(tmp = href; (tmp = strpbrk(tmp,"\r\n")); ++tmp)
+			*tmp = ' ';
+		      href_st = j;
+		    }
+		}
+	      else if(href && SPIN_TAG(in + i,"</a>"))
+		{
+		  gsize hrlen = strlen(href);
+		  /* only if it differs from the text, with or without http:// */
+		  if((hrlen != j - href_st
+		      || strncmp(out + href_st,href,hrlen))
+		     && (hrlen != j - href_st + 7
+			 || strncmp(out + href_st,href + 7,hrlen - 7)))
+		    {
+		      out[j++] = ' ';
+		      out[j++] = '(';
+		      memcpy(out + j,href,hrlen);
+		      j += hrlen;
+		      out[j++] = ')';
+		      g_free(href);
+		      href = NULL;
+		    }
+		}
+	      else if((j && (SPIN_TAG(in + i,"<p>") || SPIN_TAG(in + i,"<tr")
+			     || SPIN_TAG(in + i,"<hr") || SPIN_TAG(in + i,"<li")
+			     || SPIN_TAG(in + i,"<div")))
+		      || SPIN_TAG(in + i,"<br") || SPIN_TAG(in + i,"</table>"))
+		SPIN_PUT_NL();
+	      else if(SPIN_TAG(in + i,"<script"))
+		cdata_close_tag = "</script>";
+	      else if(SPIN_TAG(in + i,"<style"))
+		cdata_close_tag = "</style>";
+
+	      i = (in[k] == '<' || in[k] == '\0') ? k - 1 : k;
+	      continue;
+	    }
+	}
+      else if(cdata_close_tag)
+	continue;
+      else if(!g_ascii_isspace(in[i]))
+	visible = TRUE;
+
+      if(in[i] == '&' && (ent = purple_markup_unescape_entity(in + i,&entlen)))
+	{
+	  for(; *ent; ++ent)
+	    if(*ent == '\n')
+	      SPIN_PUT_NL();
+	    else
+	      out[j++] = *ent == '\r' ? ' ' : *ent;
+	  i += entlen - 1;
+	  continue;
+	}
+
+      if(visible)
+	out[j++] = g_ascii_isspace(in[i]) ? ' ' : in[i];
+    }
+
+#undef SPIN_PUT_NL
+
+  g_free(href);
+  return j;
+}
+
+gsize spin_text_out(const gchar* html,gchar* out,gboolean* me)
+{
+  gboolean nl_at_me = FALSE;
+  gsize len = spin_strip_html(html,out,&nl_at_me);
+
+  /* purple_message_meify did not take a newline after "/me" either */
+  if(me)
+    {
+      *me = len >= 4 && g_ascii_strncasecmp(out,"/me ",4) == 0 && !nl_at_me;
+      if(*me)
+	{
+	  len -= 4;
+	  memmove(out,out + 4,len);
+	}
+    }
+  return len;
+}
+
+/* what spin_text_escape does with a byte: 0 copy, 1 replace, 2 replace if
+   it starts a C1 control character */
+static const guint8 spin_escape_class[256] =
+  {
+    [0x01 ... 0x08] = 1,[0x0b] = 1,[0x0c] = 1,[0x0e ... 0x1f] = 1,
+    ['&'] = 1,['<'] = 1,['>'] = 1,['\''] = 1,['"'] = 1,[0x7f] = 1,
+    [0xc2] = 2
+  };
+
+static void spin_escape_char(GString* out,guint c)
+{
+  static const gchar hex[] = "0123456789abcdef";
+  gchar ref[8] = "&#x";
+  gsize n = 3;
+
+  switch(c)
+    {
+    case '&': g_string_append_len(out,"&amp;",5); return;
+    case '<': g_string_append_len(out,"&lt;",4); return;
+    case '>': g_string_append_len(out,"&gt;",4); return;
+    case '\'': g_string_append_len(out,"&apos;",6); return;
+    case '"': g_string_append_len(out,"&quot;",6); return;
+    }
+
+  if(c >= 0x10)
+    ref[n++] = hex[c >> 4];
+  ref[n++] = hex[c & 0xf];
+  ref[n++] = ';';
+  g_string_append_len(out,ref,n);
+}
+
+void spin_text_escape(GString* out,const gchar* text,gssize len)
+{
+  const guchar* p = (const guchar*) text;
+  const guchar* run = p,*end;
+
+  end = p + (len < 0 ? strlen(text) : (gsize) len);
+  while(p < end)
+    {
+      switch(spin_escape_class[*p])
+	{
+	case 0:
+	  ++p;
+	  continue;
+	case 1:
+	  g_string_append_len(out,(const gchar*) run,p - run);
+	  spin_escape_char(out,*p);
+	  run = ++p;
+	  continue;
+	default:
+	  /* U+0080-U+009F except U+0085 */
+	  if(p + 1 < end && p[1] >= 0x80 && p[1] <= 0x9f && p[1] != 0x85)
+	    {
+	      g_string_append_len(out,(const gchar*) run,p - run);
+	      spin_escape_char(out,p[1]);
+	      run = p += 2;
+	    }
+	  else
+	    ++p;
+	}
+    }
+  g_string_append_len(out,(const gchar*) run,p - run);
+}
@@ -0,0 +1,46 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef SPIN_TEXT_H_
+#define SPIN_TEXT_H_
+
+#include <glib.h>
+
+/* names and rooms are ISO-8859-15 on the wire, len < 0 for NUL terminated
+   input */
+gchar* spin_latin9_to_utf8(const gchar* in,gssize len);
+/* NULL for invalid UTF-8 or a character without an ISO-8859-15 form */
+gchar* spin_utf8_to_latin9(const gchar* in,gssize len);
+
+#define SPIN_TEXT_IN_MAX(len) (3 * (len) + 1)
+
+/* inbound text is UTF-8 or else ISO-8859-15. out needs
+   SPIN_TEXT_IN_MAX(len) bytes */
+gsize spin_text_in_utf8(const gchar* in,gsize len,gchar* out);
+
+/* out needs strlen(html) bytes and is not NUL terminated. A leading
+   "/me " is reported in me. */
+gsize spin_text_out(const gchar* html,gchar* out,gboolean* me);
+
+/* appends UTF-8 text to out with markup escaped as g_markup_escape_text
+   does: the five XML special characters become entities, control
+   characters other than tab and line breaks become character references.
+   len < 0 for NUL terminated text. */
+void spin_text_escape(GString* out,const gchar* text,gssize len);
+
+gsize spin_text_ascii_prefix(const gchar* in,gsize len);
+
+#endif
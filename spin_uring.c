@@ -0,0 +1,360 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "spin_uring.h"
+
+#include "debug.h"
+#include "connection.h"
+
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SPIN_URING_ENTRIES 8
+#define SPIN_URING_RECV_SIZE SPIN_READ_CHUNK_MAX
+
+enum
+  {
+    SPIN_URING_RECV = 1,
+    SPIN_URING_SEND,
+    SPIN_URING_RECV_POLL,
+    SPIN_URING_SEND_POLL,
+    SPIN_URING_CANCEL
+  };
+
+struct _SpinUring
+{
+  struct io_uring ring;
+  gint event_fd;
+  guint handle;
+  guint inflight;
+  /* output queued meanwhile is submitted at the end */
+  gboolean in_callback;
+
+  gchar* recv_buf; /* registered as fixed buffer 0 */
+  gboolean recv_pending;
+
+  /* the output ring may move while the kernel reads */
+  gchar* send_buf;
+  gsize send_size,send_off,send_len;
+};
+
+static void spin_uring_submit(SpinData* spin)
+{
+  io_uring_submit(&spin->uring->ring);
+  spin->stats.submits++;
+}
+
+static gboolean spin_uring_reserve(SpinData* spin,guint n)
+{
+  SpinUring* uring = spin->uring;
+
+  if(io_uring_sq_space_left(&uring->ring) < n)
+    spin_uring_submit(spin);
+  if(io_uring_sq_space_left(&uring->ring) >= n)
+    return TRUE;
+  purple_connection_error_reason(spin->gc,
+				 PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				 _("io_uring submission queue is full"));
+  return FALSE;
+}
+
+static struct io_uring_sqe* spin_uring_sqe(SpinUring* uring,gsize tag)
+{
+  struct io_uring_sqe* sqe = io_uring_get_sqe(&uring->ring);
+  io_uring_sqe_set_data(sqe,GSIZE_TO_POINTER(tag));
+  uring->inflight++;
+  return sqe;
+}
+
+static void spin_uring_prep_poll(SpinData* spin,gsize tag,guint events)
+{
+  struct io_uring_sqe* sqe = spin_uring_sqe(spin->uring,tag);
+  io_uring_prep_poll_add(sqe,spin->fd,events);
+  io_uring_sqe_set_flags(sqe,IOSQE_IO_LINK);
+}
+
+static void spin_uring_prep_recv(SpinData* spin)
+{
+  SpinUring* uring = spin->uring;
+  struct io_uring_sqe* sqe;
+
+  if(uring->recv_pending || !spin_uring_reserve(spin,2))
+    return;
+  spin_uring_prep_poll(spin,SPIN_URING_RECV_POLL,POLLIN);
+  sqe = spin_uring_sqe(uring,SPIN_URING_RECV);
+  io_uring_prep_read_fixed(sqe,spin->fd,uring->recv_buf,SPIN_URING_RECV_SIZE,
+			   0,0);
+  uring->recv_pending = TRUE;
+}
+
+static void spin_uring_prep_send(SpinData* spin)
+{
+  SpinUring* uring = spin->uring;
+  struct io_uring_sqe* sqe;
+  gsize avail;
+
+  if(uring->send_len || !(avail = spin_write_pending(spin))
+     || !spin_uring_reserve(spin,1))
+    return;
+
+  if(uring->send_size < avail)
+    {
+      uring->send_size = MAX(2 * uring->send_size,avail);
+      uring->send_buf = g_realloc(uring->send_buf,uring->send_size);
+    }
+  uring->send_len = spin_write_take(spin,uring->send_buf);
+  uring->send_off = 0;
+
+  sqe = spin_uring_sqe(uring,SPIN_URING_SEND);
+  io_uring_prep_send(sqe,spin->fd,uring->send_buf,uring->send_len,0);
+  spin->stats.send_calls++;
+}
+
+/* with wait the rest is sent once the socket is writable again */
+static void spin_uring_resend(SpinData* spin,gboolean wait)
+{
+  SpinUring* uring = spin->uring;
+  struct io_uring_sqe* sqe;
+
+  if(!spin_uring_reserve(spin,wait ? 2 : 1))
+    return;
+  if(wait)
+    spin_uring_prep_poll(spin,SPIN_URING_SEND_POLL,POLLOUT);
+  sqe = spin_uring_sqe(uring,SPIN_URING_SEND);
+  io_uring_prep_send(sqe,spin->fd,uring->send_buf + uring->send_off,
+		     uring->send_len - uring->send_off,0);
+  spin->stats.send_calls++;
+}
+
+static gboolean spin_uring_recv_done(SpinData* spin,gint res)
+{
+  SpinUring* uring = spin->uring;
+  PurpleConnection* gc = spin->gc;
+
+  uring->recv_pending = FALSE;
+  spin->stats.read_calls++;
+
+  /* the socket is nonblocking */
+  if(res == -EAGAIN || res == -EINTR)
+    {
+      spin_uring_prep_recv(spin);
+      return TRUE;
+    }
+
+  if(res <= 0)
+    {
+      purple_connection_error_reason(gc,PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				     res ? g_strerror(-res)
+				     : _("Server closed the connection"));
+      return FALSE;
+    }
+
+  memcpy(spin_framer_reserve(spin->inbuf,res),uring->recv_buf,res);
+  spin_framer_commit(spin->inbuf,res);
+  spin->stats.read_wakeups++;
+  spin->stats.read_bytes += res;
+  spin_try_parse(spin);
+
+  if(spin_framer_pending(spin->inbuf) >= spin->max_inbuf)
+    {
+      purple_connection_error_reason(gc,PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				     _("received line is too long"));
+      return FALSE;
+    }
+
+  spin_uring_prep_recv(spin);
+  return TRUE;
+}
+
+static gboolean spin_uring_send_done(SpinData* spin,gint res)
+{
+  SpinUring* uring = spin->uring;
+
+  if(res < 0 && res != -EAGAIN && res != -EINTR)
+    {
+      purple_connection_error_reason(spin->gc,
+				     PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				     g_strerror(-res));
+      return FALSE;
+    }
+
+  spin->stats.write_wakeups++;
+  if(res > 0)
+    {
+      uring->send_off += res;
+      spin_write_done(spin,res);
+    }
+  if(uring->send_off < uring->send_len)
+    {
+      /* resending right away would spin while the socket is full */
+      spin_uring_resend(spin,res < 0);
+      return TRUE;
+    }
+
+  uring->send_len = uring->send_off = 0;
+  spin_uring_prep_send(spin);
+  return TRUE;
+}
+
+/* the linked read or send reports on its own */
+static gboolean spin_uring_poll_done(SpinData* spin,gint res)
+{
+  if(res >= 0 || res == -ECANCELED)
+    return TRUE;
+  purple_connection_error_reason(spin->gc,
+				 PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				 g_strerror(-res));
+  return FALSE;
+}
+
+static void uring_cb(gpointer data,gint fd,
+		     PurpleInputCondition cond G_GNUC_UNUSED)
+{
+  PurpleConnection* gc = (PurpleConnection*) data;
+  SpinData* spin = (SpinData*) gc->proto_data;
+  struct io_uring_cqe* cqe;
+  eventfd_t value;
+  gboolean ok = TRUE;
+
+  if(!spin || !spin->uring)
+    return;
+
+  SpinUring* uring = spin->uring;
+  eventfd_read(fd,&value);
+
+  uring->in_callback = TRUE;
+  while(ok && io_uring_peek_cqe(&uring->ring,&cqe) == 0)
+    {
+      gsize tag = GPOINTER_TO_SIZE(io_uring_cqe_get_data(cqe));
+      gint res = cqe->res;
+      io_uring_cqe_seen(&uring->ring,cqe);
+      uring->inflight--;
+
+      if(tag == SPIN_URING_RECV)
+	ok = spin_uring_recv_done(spin,res);
+      else if(tag == SPIN_URING_SEND)
+	ok = spin_uring_send_done(spin,res);
+      else if(tag == SPIN_URING_RECV_POLL || tag == SPIN_URING_SEND_POLL)
+	ok = spin_uring_poll_done(spin,res);
+    }
+  uring->in_callback = FALSE;
+
+  if(ok)
+    spin_uring_submit(spin);
+  spin_io_stats_tick(spin);
+}
+
+gboolean spin_uring_start(SpinData* spin)
+{
+  SpinUring* uring = g_new0(SpinUring,1);
+  struct iovec iov;
+  gint ret;
+
+  if((ret = io_uring_queue_init(SPIN_URING_ENTRIES,&uring->ring,0)) < 0)
+    {
+      purple_debug_info("spin","io_uring not available: %s\n",
+			g_strerror(-ret));
+      g_free(uring);
+      return FALSE;
+    }
+
+  uring->recv_buf = g_malloc(SPIN_URING_RECV_SIZE);
+  iov.iov_base = uring->recv_buf;
+  iov.iov_len = SPIN_URING_RECV_SIZE;
+  uring->event_fd = eventfd(0,EFD_CLOEXEC|EFD_NONBLOCK);
+
+  if(uring->event_fd < 0
+     || (ret = io_uring_register_buffers(&uring->ring,&iov,1)) < 0
+     || (ret = io_uring_register_eventfd(&uring->ring,uring->event_fd)) < 0)
+    {
+      purple_debug_info("spin","io_uring setup failed: %s\n",
+			g_strerror(uring->event_fd < 0 ? errno : -ret));
+      io_uring_queue_exit(&uring->ring);
+      if(uring->event_fd >= 0)
+	close(uring->event_fd);
+      g_free(uring->recv_buf);
+      g_free(uring);
+      return FALSE;
+    }
+
+  spin->uring = uring;
+  uring->handle = purple_input_add(uring->event_fd,PURPLE_INPUT_READ,
+				   uring_cb,spin->gc);
+  spin_uring_prep_recv(spin);
+  spin_uring_prep_send(spin);
+  spin_uring_submit(spin);
+  purple_debug_info("spin","using io_uring for the chat connection\n");
+  return TRUE;
+}
+
+void spin_uring_flush(SpinData* spin)
+{
+  SpinUring* uring = spin->uring;
+  g_return_if_fail(uring);
+
+  if(uring->send_len)
+    return;
+  spin_uring_prep_send(spin);
+  if(!uring->in_callback)
+    spin_uring_submit(spin);
+}
+
+void spin_uring_stop(SpinData* spin)
+{
+  SpinUring* uring = spin->uring;
+  struct io_uring_cqe* cqe;
+  struct io_uring_sqe* sqe;
+
+  if(!uring)
+    return;
+
+  purple_input_remove(uring->handle);
+
+  /* a read or send may still wait behind its poll */
+  io_uring_submit(&uring->ring);
+  if(uring->recv_pending)
+    {
+      sqe = spin_uring_sqe(uring,SPIN_URING_CANCEL);
+      io_uring_prep_cancel(sqe,GSIZE_TO_POINTER(SPIN_URING_RECV_POLL),0);
+      sqe = spin_uring_sqe(uring,SPIN_URING_CANCEL);
+      io_uring_prep_cancel(sqe,GSIZE_TO_POINTER(SPIN_URING_RECV),0);
+    }
+  if(uring->send_len)
+    {
+      sqe = spin_uring_sqe(uring,SPIN_URING_CANCEL);
+      io_uring_prep_cancel(sqe,GSIZE_TO_POINTER(SPIN_URING_SEND_POLL),0);
+      sqe = spin_uring_sqe(uring,SPIN_URING_CANCEL);
+      io_uring_prep_cancel(sqe,GSIZE_TO_POINTER(SPIN_URING_SEND),0);
+    }
+  io_uring_submit(&uring->ring);
+  while(uring->inflight && io_uring_wait_cqe(&uring->ring,&cqe) == 0)
+    {
+      io_uring_cqe_seen(&uring->ring,cqe);
+      uring->inflight--;
+    }
+
+  io_uring_queue_exit(&uring->ring);
+  close(uring->event_fd);
+  g_free(uring->recv_buf);
+  g_free(uring->send_buf);
+  g_free(uring);
+  spin->uring = NULL;
+}
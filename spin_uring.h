@@ -0,0 +1,32 @@
+/* Copyright 2009 Thomas Weidner */
+
+/* This file is part of Purple-Spin. */
+
+/* Purple-Spin is free software: you can redistribute it and/or modify */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or */
+/* (at your option) any later version. */
+
+/* Purple-Spin is distributed in the hope that it will be useful, */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the */
+/* GNU General Public License for more details. */
+
+/* You should have received a copy of the GNU General Public License */
+/* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef SPIN_URING_H_
+#define SPIN_URING_H_
+
+#include "spin.h"
+
+#if SPIN_USE_IO_URING
+
+/* FALSE if the kernel lacks io_uring */
+gboolean spin_uring_start(SpinData* spin);
+void spin_uring_flush(SpinData* spin);
+void spin_uring_stop(SpinData* spin);
+
+#endif
+
+#endif
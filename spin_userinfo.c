@@ -21,6 +21,9 @@
 #include <libxml/xpath.h>
 
 #include "spin_web.h"
+#include "spin_patterns.h"
+
+#include <string.h>
 
 typedef struct _PicInfo
 {
@@ -50,17 +53,11 @@ static gchar* spin_get_nodeset_content(xmlNodeSetPtr ns)
 
 static void get_head_info(PurpleNotifyUserInfo* ui,xmlXPathContextPtr ctxt)
 {
-  static xmlXPathCompExprPtr xpath = NULL;
-  if(!xpath) /* race condition */
-    {
-      xpath = xmlXPathCompile((xmlChar*)"string(//div[@class='sbox']/p)");
-      g_assert(xpath);
-    }
-
   g_return_if_fail(ui);
   g_return_if_fail(ctxt);
 
-  xmlXPathObjectPtr res = xmlXPathCompiledEval(xpath,ctxt);
+  xmlXPathObjectPtr res =
+    xmlXPathCompiledEval(spin_patterns()->head_info,ctxt);
   g_return_if_fail(res);
 
   if(res->type == XPATH_STRING && *res->stringval)
@@ -76,29 +73,23 @@ static void get_head_info(PurpleNotifyUserInfo* ui,xmlXPathContextPtr ctxt)
 
 static gchar* get_img_info(PurpleNotifyUserInfo* ui,xmlXPathContextPtr ctxt)
 {
-  static xmlXPathCompExprPtr xpath = NULL;
-  gchar* val = NULL;
-  if(!xpath) /* race condition */
-    {
-      xpath = xmlXPathCompile((xmlChar*)"string(//img[@class='thumb']/@src)");
-      g_assert(xpath);
-    }
+  gchar *val = NULL,*mini;
 
   g_return_val_if_fail(ctxt,NULL);
   g_return_val_if_fail(ui,NULL);
 
-  xmlXPathObjectPtr res = xmlXPathCompiledEval(xpath,ctxt);
+  xmlXPathObjectPtr res =
+    xmlXPathCompiledEval(spin_patterns()->img_info,ctxt);
   g_return_val_if_fail(res,NULL);
 
   if(res->type == XPATH_STRING && *res->stringval)
     {
       purple_notify_user_info_add_pair(ui,_("Image"),_("loading..."));
       purple_notify_user_info_add_section_break(ui);
-      GRegex* regex = g_regex_new("/mini/",0,0,NULL);
-      val = g_regex_replace_literal(regex,(gchar*)res->stringval,-1,0,"/full/",
-				    0,NULL);
-      /* val = g_strdup((gchar*) res->stringval); */
-      g_regex_unref(regex);
+      /* the full size image, both path parts have the same length */
+      val = g_strdup((gchar*) res->stringval);
+      for(mini = val; (mini = strstr(mini,"/mini/")); mini += 6)
+	memcpy(mini,"/full/",6);
     }
 
   xmlXPathFreeObject(res);
@@ -107,24 +98,12 @@ static gchar* get_img_info(PurpleNotifyUserInfo* ui,xmlXPathContextPtr ctxt)
 
 static void get_profile_info(PurpleNotifyUserInfo* ui,xmlXPathContextPtr ctxt)
 {
-  static xmlXPathCompExprPtr label_xpath = NULL;
-  static xmlXPathCompExprPtr siblings_xpath = NULL;
-  if(!label_xpath) /* race condition */
-    {
-      label_xpath = xmlXPathCompile((xmlChar*)"//*[@class='label']");
-      g_assert(label_xpath);
-    }
-  if(!siblings_xpath)
-    {
-      siblings_xpath = xmlXPathCompile((xmlChar*)"following-sibling::text()"
-				       "|following-sibling::*");
-      g_assert(siblings_xpath);
-    }
+  const SpinPatterns* patterns = spin_patterns();
 
   g_return_if_fail(ui);
   g_return_if_fail(ctxt);
 
-  xmlXPathObjectPtr res = xmlXPathCompiledEval(label_xpath,ctxt);
+  xmlXPathObjectPtr res = xmlXPathCompiledEval(patterns->profile_labels,ctxt);
   g_return_if_fail(res);
 
   if(res->type == XPATH_NODESET)
@@ -135,8 +114,8 @@ static void get_profile_info(PurpleNotifyUserInfo* ui,xmlXPathContextPtr ctxt)
 	{
 	  xmlNodePtr node = res->nodesetval->nodeTab[i];
 	  ctxt->node = node;
-	  xmlXPathObjectPtr local_res = xmlXPathCompiledEval(siblings_xpath,
-							     ctxt);
+	  xmlXPathObjectPtr local_res =
+	    xmlXPathCompiledEval(patterns->profile_siblings,ctxt);
 	  if(!local_res)
 	    continue;
 	  xmlChar* label = xmlNodeGetContent(node);
@@ -16,6 +16,7 @@
 /* along with Purple-Spin.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "spin_web.h"
+#include "spin_patterns.h"
 #include <stdarg.h>
 #include <string.h>
 
@@ -44,7 +45,6 @@ static void spin_web_json_cb(PurpleUtilFetchUrlData *url_data,
 			     const gchar *error_message)
 {
   WebJsonData* data = (WebJsonData*) user_data;
-  static GRegex *string_literal_re;
   gchar *fixed = NULL;
   JsonParser *parser = NULL;
   GError *error = NULL;
@@ -55,17 +55,8 @@ static void spin_web_json_cb(PurpleUtilFetchUrlData *url_data,
       goto exit;
     }
 
-  if(!string_literal_re) /* TODO: race condition */
-    {
-      GError* error = NULL;
-      string_literal_re = g_regex_new
-	("(['\"])((?:(?!\\1)[^\\x00-\\x1f\\\\]||\\\\[\\\\/bfnrt]|\\\\\\1"
-	 "|\\\\u[0-9a-fA-F]{4}|\\\\[\\x20-\\xff])*)\\1",0,0,&error);
-      g_assert(error == NULL);
-    }
-  
   parser = json_parser_new();
-  fixed = g_regex_replace(string_literal_re,
+  fixed = g_regex_replace(spin_patterns()->string_literal,
 			  url_text,len,0,
 			  "\"\\2\"",0,&error);
   g_assert(error == NULL);